@@ -7,6 +7,7 @@
 #include  <Protocol/LoadedImage.h>
 #include  <Protocol/SimpleFileSystem.h>
 #include  <Guid/FileInfo.h>
+#include  <Guid/Acpi.h>
 
 #include "memory_map.hpp"
 #include "elf.hpp"
@@ -283,6 +284,17 @@ UefiMain(
         Halt();
     }
 
+    // カーネルに渡すACPI 2.0のRSDPを探す（見つからなければNULL）
+    VOID* acpi_table = NULL;
+    for (UINTN i = 0; i < system_table->NumberOfTableEntries; ++i)
+    {
+        if (CompareGuid(&gEfiAcpiTableGuid, &system_table->ConfigurationTable[i].VendorGuid))
+        {
+            acpi_table = system_table->ConfigurationTable[i].VendorTable;
+            break;
+        }
+    }
+
     // ブートサービスを停止する
     status = gBS->ExitBootServices(image_handle, memmap.map_key);
     if (EFI_ERROR(status))
@@ -317,6 +329,13 @@ UefiMain(
     case PixelBlueGreenRedReserved8BitPerColor:
         config.pixel_format = kPixelBGRResv8BitPerColor;
         break;
+    case PixelBitMask:
+        config.pixel_format = kPixelBitMask;
+        config.pixel_bitmask.red_mask = gop->Mode->Info->PixelInformation.RedMask;
+        config.pixel_bitmask.green_mask = gop->Mode->Info->PixelInformation.GreenMask;
+        config.pixel_bitmask.blue_mask = gop->Mode->Info->PixelInformation.BlueMask;
+        config.pixel_bitmask.reserved_mask = gop->Mode->Info->PixelInformation.ReservedMask;
+        break;
     default:
         Print(L"unimplemented pixel format: %d\n", gop->Mode->Info->PixelFormat);
         Halt();
@@ -326,9 +345,9 @@ UefiMain(
     // EFIのエントリーポイントは先頭から24バイトの位置に8バイトの整数として格納されている
     UINT64 entry_addr = *(UINT64*)(kernel_first_addr + 24);
 
-    typedef void EntryPointType(struct FrameBufferConfig*, struct MemoryMap*);
+    typedef void EntryPointType(struct FrameBufferConfig*, struct MemoryMap*, VOID*);
     EntryPointType* entry_point = (EntryPointType*)entry_addr;
-    entry_point(&config, &memmap);
+    entry_point(&config, &memmap, acpi_table);
 
     Print(L"All done!\n");
 
@@ -0,0 +1,187 @@
+#include "acpi.hpp"
+
+#include <cstring>
+
+#include "ioapic.hpp"
+
+namespace
+{
+    uint8_t sum_bytes(const void* data, const size_t bytes)
+    {
+        const auto p = reinterpret_cast<const uint8_t*>(data);
+        uint8_t sum = 0;
+        for (size_t i = 0; i < bytes; ++i)
+        {
+            sum += p[i];
+        }
+        return sum;
+    }
+
+    // MADT のエントリに共通の先頭部分
+    struct MADTEntryHeader
+    {
+        uint8_t type;
+        uint8_t length;
+    } __attribute__((packed));
+
+    enum MADTEntryType : uint8_t
+    {
+        kLocalAPIC = 0,
+        kIOAPIC = 1,
+        kInterruptSourceOverride = 2,
+    };
+
+    struct LocalAPICEntry
+    {
+        MADTEntryHeader header;
+        uint8_t processor_uid;
+        uint8_t apic_id;
+        uint32_t flags; // ビット0: 使用可能
+    } __attribute__((packed));
+
+    struct IOAPICEntry
+    {
+        MADTEntryHeader header;
+        uint8_t ioapic_id;
+        uint8_t reserved;
+        uint32_t address;
+        uint32_t gsi_base;
+    } __attribute__((packed));
+
+    struct InterruptSourceOverrideEntry
+    {
+        MADTEntryHeader header;
+        uint8_t bus; // 0: ISA
+        uint8_t source; // ISA の IRQ
+        uint32_t gsi;
+        uint16_t flags;
+    } __attribute__((packed));
+
+    constexpr int NUM_ISA_IRQS = 16;
+
+    int num_processors = 0;
+    uint8_t processor_apic_ids[acpi::MAX_PROCESSORS];
+    uintptr_t ioapic_address = ioapic::DEFAULT_BASE;
+    uint32_t isa_irq_gsi[NUM_ISA_IRQS] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+
+    void parse_madt(const acpi::MADT& madt)
+    {
+        const auto begin = reinterpret_cast<uintptr_t>(&madt) + sizeof(acpi::MADT);
+        const auto end = reinterpret_cast<uintptr_t>(&madt) + madt.header.length;
+        for (auto iter = begin; iter + sizeof(MADTEntryHeader) <= end;)
+        {
+            const auto entry = reinterpret_cast<const MADTEntryHeader*>(iter);
+            if (entry->length < sizeof(MADTEntryHeader))
+            {
+                break;
+            }
+            switch (entry->type)
+            {
+            case kLocalAPIC:
+                {
+                    // 無効のもの（起動後に追加できるものも含む）は起動時には立ち上げない
+                    const auto lapic = reinterpret_cast<const LocalAPICEntry*>(entry);
+                    if ((lapic->flags & 1u) && num_processors < acpi::MAX_PROCESSORS)
+                    {
+                        processor_apic_ids[num_processors++] = lapic->apic_id;
+                    }
+                    break;
+                }
+            case kIOAPIC:
+                {
+                    // ISA の割り込みを受ける，GSI 0 から始まる I/O APIC を使う
+                    const auto io = reinterpret_cast<const IOAPICEntry*>(entry);
+                    if (io->gsi_base == 0)
+                    {
+                        ioapic_address = io->address;
+                    }
+                    break;
+                }
+            case kInterruptSourceOverride:
+                {
+                    const auto iso = reinterpret_cast<const InterruptSourceOverrideEntry*>(entry);
+                    if (iso->bus == 0 && iso->source < NUM_ISA_IRQS)
+                    {
+                        isa_irq_gsi[iso->source] = iso->gsi;
+                    }
+                    break;
+                }
+            default:
+                break;
+            }
+            iter += entry->length;
+        }
+    }
+}
+
+namespace acpi
+{
+    bool RSDP::is_valid() const
+    {
+        // XSDT を使うので ACPI 2.0 以降（revision 2 以上）の RSDP だけを受け付ける
+        return strncmp(signature, "RSD PTR ", 8) == 0 && revision >= 2 &&
+            sum_bytes(this, 20) == 0 && sum_bytes(this, 36) == 0;
+    }
+
+    bool DescriptionHeader::is_valid(const char* expected_signature) const
+    {
+        return strncmp(signature, expected_signature, 4) == 0 && sum_bytes(this, length) == 0;
+    }
+
+    size_t XSDT::count() const
+    {
+        return (header.length - sizeof(DescriptionHeader)) / sizeof(uint64_t);
+    }
+
+    const DescriptionHeader& XSDT::operator[](const size_t i) const
+    {
+        // エントリは8バイト境界に揃っているとは限らない
+        uint64_t address;
+        memcpy(&address, reinterpret_cast<const uint8_t*>(&header) + sizeof(DescriptionHeader) + 8 * i, 8);
+        return *reinterpret_cast<const DescriptionHeader*>(address);
+    }
+
+    Error initialize(const RSDP* rsdp)
+    {
+        if (rsdp == nullptr || !rsdp->is_valid())
+        {
+            return MAKE_ERROR(Error::kInvalidACPITable);
+        }
+        const auto& xsdt = *reinterpret_cast<const XSDT*>(rsdp->xsdt_address);
+        if (!xsdt.header.is_valid("XSDT"))
+        {
+            return MAKE_ERROR(Error::kInvalidACPITable);
+        }
+
+        for (size_t i = 0; i < xsdt.count(); ++i)
+        {
+            const auto& table = xsdt[i];
+            if (table.is_valid("APIC"))
+            {
+                parse_madt(reinterpret_cast<const MADT&>(table));
+                return MAKE_ERROR(Error::kSuccess);
+            }
+        }
+        return MAKE_ERROR(Error::kInvalidACPITable);
+    }
+
+    int num_processors()
+    {
+        return ::num_processors;
+    }
+
+    uint8_t processor_apic_id(const int i)
+    {
+        return processor_apic_ids[i];
+    }
+
+    uintptr_t ioapic_address()
+    {
+        return ::ioapic_address;
+    }
+
+    uint32_t irq_to_gsi(const uint8_t irq)
+    {
+        return irq < NUM_ISA_IRQS ? isa_irq_gsi[irq] : irq;
+    }
+}
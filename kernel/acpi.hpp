@@ -0,0 +1,83 @@
+#ifndef ACPI_HPP
+#define ACPI_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+
+/**
+ * @file acpi.hpp
+ *
+ * ACPI のテーブルからカーネルに必要な構成を読み出す．
+ *
+ * いまは MADT（Multiple APIC Description Table）だけを読み，
+ * プロセッサ（Local APIC）の一覧，I/O APIC の番地，ISA の IRQ と GSI の対応を得る．
+ */
+
+namespace acpi
+{
+    // ブートローダーが UEFI のシステムテーブルから見つけて渡す
+    struct RSDP
+    {
+        char signature[8];
+        uint8_t checksum;
+        char oem_id[6];
+        uint8_t revision;
+        uint32_t rsdt_address;
+        uint32_t length;
+        uint64_t xsdt_address;
+        uint8_t extended_checksum;
+        char reserved[3];
+
+        [[nodiscard]] bool is_valid() const;
+    } __attribute__((packed));
+
+    struct DescriptionHeader
+    {
+        char signature[4];
+        uint32_t length;
+        uint8_t revision;
+        uint8_t checksum;
+        char oem_id[6];
+        char oem_table_id[8];
+        uint32_t oem_revision;
+        uint32_t creator_id;
+        uint32_t creator_revision;
+
+        [[nodiscard]] bool is_valid(const char* expected_signature) const;
+    } __attribute__((packed));
+
+    struct XSDT
+    {
+        DescriptionHeader header;
+
+        [[nodiscard]] size_t count() const;
+        [[nodiscard]] const DescriptionHeader& operator[](size_t i) const;
+    } __attribute__((packed));
+
+    struct MADT
+    {
+        DescriptionHeader header;
+        uint32_t local_apic_address;
+        uint32_t flags;
+        // この後に可変長のエントリが並ぶ
+    } __attribute__((packed));
+
+    // 扱えるプロセッサの数の上限
+    constexpr int MAX_PROCESSORS = 64;
+
+    // rsdp が nullptr や壊れたテーブルなら，BSP だけの構成とみなしてエラーを返す
+    Error initialize(const RSDP* rsdp);
+
+    // 使えるプロセッサの数と，それぞれの Local APIC ID（BSP を含む）
+    [[nodiscard]] int num_processors();
+    [[nodiscard]] uint8_t processor_apic_id(int i);
+
+    // MADT に I/O APIC がなければ ioapic::DEFAULT_BASE を返す
+    [[nodiscard]] uintptr_t ioapic_address();
+    // ISA の irq がつながっている I/O APIC の入力（GSI）．上書きがなければ irq と同じ
+    [[nodiscard]] uint32_t irq_to_gsi(uint8_t irq);
+}
+
+#endif //ACPI_HPP
@@ -19,6 +19,20 @@ IoIn32:
     in eax, dx
     ret
 
+global IoOut8  ; void IoOut8(uint16_t addr, uint8_t data);
+IoOut8:
+    mov dx, di    ; dx = addr
+    mov al, sil   ; al = data
+    out dx, al
+    ret
+
+global IoIn8  ; uint8_t IoIn8(uint16_t addr);
+IoIn8:
+    mov dx, di    ; dx = addr
+    xor eax, eax
+    in al, dx
+    ret
+
 global GetCS  ; uint16_t GetCS(void);
 GetCS:
     xor eax, eax  ; also clears upper 32bits of rax
@@ -71,6 +85,130 @@ SetCSSS:
     pop rbp
     ret
 
+global SetCR3  ; void SetCR3(uint64_t value);
+SetCR3:
+    mov cr3, rdi
+    ret
+
+global GetCR3  ; uint64_t GetCR3(void);
+GetCR3:
+    mov rax, cr3
+    ret
+
+global ReadMSR  ; uint64_t ReadMSR(uint32_t msr);
+ReadMSR:
+    mov ecx, edi
+    rdmsr
+    shl rdx, 32
+    or rax, rdx
+    ret
+
+global WriteMSR  ; void WriteMSR(uint32_t msr, uint64_t value);
+WriteMSR:
+    mov ecx, edi
+    mov eax, esi
+    mov rdx, rsi
+    shr rdx, 32
+    wrmsr
+    ret
+
+global LoadTR  ; void LoadTR(uint16_t selector);
+LoadTR:
+    ltr di
+    ret
+
+; APを起動するトランポリン
+; ApTrampolineStartからApTrampolineEndまでを1MiB未満のページ境界にコピーし、
+; そのページ番号をSIPIのベクタとしてAPに送る。APはリアルモードでコピーの先頭から動き出す。
+; 位置に依存する番地(GDTRとfar jumpの飛び先)は、CSから求めたコピーの番地を足して実行時に書き換える。
+; 64ビットモードに移った後はApTrampolineParamsのCR3、スタック、エントリポイント、引数を使う。
+bits 16
+global ApTrampolineStart
+ApTrampolineStart:
+    cli
+    cld
+    mov ax, cs
+    mov ds, ax
+    xor ebx, ebx
+    mov bx, ax
+    shl ebx, 4  ; ebx = コピーの先頭の番地
+
+    lea eax, [ebx + (ApTrampolineGDT - ApTrampolineStart)]
+    mov [ApTrampolineGDTR - ApTrampolineStart + 2], eax
+    lea eax, [ebx + (ApTrampoline32 - ApTrampolineStart)]
+    mov [ApTrampolineJump32 - ApTrampolineStart], eax
+    lea eax, [ebx + (ApTrampoline64 - ApTrampolineStart)]
+    mov [ApTrampolineJump64 - ApTrampolineStart], eax
+
+    lgdt [ApTrampolineGDTR - ApTrampolineStart]
+    mov eax, cr0
+    or eax, 1  ; PE
+    mov cr0, eax
+    jmp far dword [ApTrampolineJump32 - ApTrampolineStart]
+
+bits 32
+ApTrampoline32:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    mov eax, cr4
+    or eax, (1 << 5) | (1 << 9) | (1 << 10)  ; PAE, OSFXSR, OSXMMEXCPT
+    mov cr4, eax
+    mov eax, [ebx + (ApTrampolineParams - ApTrampolineStart)]  ; CR3(4GiB未満であること)
+    mov cr3, eax
+    mov ecx, 0xc0000080  ; IA32_EFER
+    rdmsr
+    or eax, 1 << 8  ; LME
+    wrmsr
+    mov eax, cr0
+    and eax, ~((1 << 30) | (1 << 29) | (1 << 2))  ; CD, NW, EM (INIT直後はキャッシュが無効)
+    or eax, (1 << 31) | (1 << 1)  ; PG, MP
+    mov cr0, eax
+    jmp far [ebx + (ApTrampolineJump64 - ApTrampolineStart)]
+
+bits 64
+ApTrampoline64:
+    mov ebx, ebx  ; 64ビットモードに移るとレジスタの上位32ビットは不定
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov rsp, [rbx + (ApTrampolineParams - ApTrampolineStart) + 8]
+    mov rax, [rbx + (ApTrampolineParams - ApTrampolineStart) + 16]
+    mov rdi, [rbx + (ApTrampolineParams - ApTrampolineStart) + 24]
+    call rax
+.fin:
+    hlt
+    jmp .fin
+
+align 8
+ApTrampolineGDT:
+    dq 0
+    dq 0x00cf9a000000ffff  ; 0x08: 32ビットコード
+    dq 0x00cf92000000ffff  ; 0x10: データ
+    dq 0x00af9a000000ffff  ; 0x18: 64ビットコード
+ApTrampolineGDTR:
+    dw 4 * 8 - 1
+    dd 0
+ApTrampolineJump32:
+    dd 0
+    dw 0x08
+ApTrampolineJump64:
+    dd 0
+    dw 0x18
+
+align 8
+global ApTrampolineParams
+ApTrampolineParams:
+    dq 0  ; CR3
+    dq 0  ; スタックの末尾
+    dq 0  ; エントリポイント
+    dq 0  ; エントリポイントの第1引数
+global ApTrampolineEnd
+ApTrampolineEnd:
+
 extern kernel_main_stack;
 extern KernelMainNewStack;
 
@@ -81,3 +219,30 @@ KernelMain:
 .fin:
     hlt
     jmp .fin
+
+global SwitchContext  ; void SwitchContext(TaskContext* next, TaskContext* current);
+SwitchContext:
+    ; 今のタスクのレジスタを退避する．戻り先はスタックに積まれている
+    mov [rsi + 0x08], rbx
+    mov [rsi + 0x10], rbp
+    mov [rsi + 0x18], r12
+    mov [rsi + 0x20], r13
+    mov [rsi + 0x28], r14
+    mov [rsi + 0x30], r15
+    pushfq
+    pop qword [rsi + 0x38]
+    fxsave [rsi + 0x40]
+    mov [rsi + 0x00], rsp
+
+    ; 次のタスクのレジスタを復帰し，そのタスクが SwitchContext を呼んだ所へ戻る
+    fxrstor [rdi + 0x40]
+    mov rsp, [rdi + 0x00]
+    mov rbx, [rdi + 0x08]
+    mov rbp, [rdi + 0x10]
+    mov r12, [rdi + 0x18]
+    mov r13, [rdi + 0x20]
+    mov r14, [rdi + 0x28]
+    mov r15, [rdi + 0x30]
+    push qword [rdi + 0x38]
+    popfq
+    ret
@@ -3,11 +3,31 @@
 
 #include <cstdint>
 
+struct TaskContext;
+
 extern "C" {
 void IoOut32(uint16_t addr, uint32_t data);
 uint32_t IoIn32(uint16_t addr);
+void IoOut8(uint16_t addr, uint8_t data);
+uint8_t IoIn8(uint16_t addr);
 uint16_t GetCS(void);
 void LoadIDT(uint16_t limit, uint64_t offset);
+void LoadGDT(uint16_t limit, uint64_t offset);
+void SetDSAll(uint16_t value);
+void SetCSSS(uint16_t cs, uint16_t ss);
+void LoadTR(uint16_t selector);
+void SetCR3(uint64_t value);
+uint64_t GetCR3(void);
+uint64_t ReadMSR(uint32_t msr);
+void WriteMSR(uint32_t msr, uint64_t value);
+
+// currentにレジスタを退避してnextのタスクに切り替える
+void SwitchContext(TaskContext *next, TaskContext *current);
+
+// APを起動するトランポリンのコードと、その中の引数の領域
+extern char ApTrampolineStart[];
+extern char ApTrampolineParams[];
+extern char ApTrampolineEnd[];
 }
 
 #endif //ASMFUNC_HPP
@@ -0,0 +1,187 @@
+#include "buddy.hpp"
+
+#include <cstring>
+
+namespace
+{
+    // bytes バイトを収める最小の order
+    int order_for(const size_t bytes)
+    {
+        const size_t frames = (bytes + BYTES_PER_FRAME - 1) / BYTES_PER_FRAME;
+        int order = 0;
+        while ((static_cast<size_t>(1) << order) < frames)
+        {
+            ++order;
+        }
+        return order;
+    }
+}
+
+Error BuddyAllocator::initialize(FrameManager& frames, size_t max_blocks)
+{
+    constexpr size_t block_frames = static_cast<size_t>(1) << MAX_ORDER;
+    for (; max_blocks > 0; max_blocks /= 2)
+    {
+        const size_t state_frames = (max_blocks * block_frames + BYTES_PER_FRAME - 1) / BYTES_PER_FRAME;
+        const auto region = frames.allocate(max_blocks * block_frames, block_frames);
+        if (region.error)
+        {
+            continue;
+        }
+        const auto state_region = frames.allocate(state_frames);
+        if (state_region.error)
+        {
+            frames.free(region.value, max_blocks * block_frames);
+            continue;
+        }
+
+        base = reinterpret_cast<uintptr_t>(region.value.frame());
+        num_frames = max_blocks * block_frames;
+        states = static_cast<uint8_t*>(state_region.value.frame());
+        memset(states, NOT_HEAD, num_frames);
+        for (size_t i = 0; i < num_frames; i += block_frames)
+        {
+            push_free(i, MAX_ORDER);
+        }
+        return MAKE_ERROR(Error::kSuccess);
+    }
+    return MAKE_ERROR(Error::kNoEnoughMemory);
+}
+
+void BuddyAllocator::initialize_on_first_use(FrameManager& frames, const size_t max_blocks)
+{
+    deferred_frames = &frames;
+    deferred_blocks = max_blocks;
+}
+
+WithError<void*> BuddyAllocator::allocate_order(const int order)
+{
+    if (order < 0 || order > MAX_ORDER)
+    {
+        return {nullptr, MAKE_ERROR(Error::kInvalidArgument)};
+    }
+    if (deferred_frames)
+    {
+        auto& frames = *deferred_frames;
+        deferred_frames = nullptr;
+        if (auto err = initialize(frames, deferred_blocks))
+        {
+            return {nullptr, err};
+        }
+    }
+
+    int found = order;
+    while (found <= MAX_ORDER && free_lists[found] == nullptr)
+    {
+        ++found;
+    }
+    if (found > MAX_ORDER)
+    {
+        return {nullptr, MAKE_ERROR(Error::kNoEnoughMemory)};
+    }
+
+    const size_t index = index_of(free_lists[found]);
+    remove_free(index, found);
+    // 前半を手元に残し，後半を1段下の空きリストへ返していく
+    while (found > order)
+    {
+        --found;
+        push_free(index + (static_cast<size_t>(1) << found), found);
+    }
+    states[index] = order;
+    return {block_at(index), MAKE_ERROR(Error::kSuccess)};
+}
+
+WithError<void*> BuddyAllocator::allocate(const size_t bytes, const size_t alignment, const size_t boundary)
+{
+    // ブロックは自分の大きさで整列しているので，大きさを整列と同じまで増やせば整列の要求も満たす
+    int order = order_for(bytes);
+    const int alignment_order = order_for(alignment);
+    if (alignment_order > order)
+    {
+        order = alignment_order;
+    }
+    // 境界以下の大きさのブロックは境界をまたがない
+    if (boundary != 0 && (BYTES_PER_FRAME << order) > boundary)
+    {
+        return {nullptr, MAKE_ERROR(Error::kInvalidArgument)};
+    }
+    return allocate_order(order);
+}
+
+void BuddyAllocator::free(void* block)
+{
+    size_t index = index_of(block);
+    int order = states[index];
+    states[index] = NOT_HEAD;
+    while (order < MAX_ORDER)
+    {
+        const size_t buddy = index ^ static_cast<size_t>(1) << order;
+        if (states[buddy] != (FREE_FLAG | order))
+        {
+            break;
+        }
+        remove_free(buddy, order);
+        states[buddy] = NOT_HEAD;
+        index &= ~(static_cast<size_t>(1) << order);
+        ++order;
+    }
+    push_free(index, order);
+}
+
+int BuddyAllocator::largest_free_order() const
+{
+    for (int order = MAX_ORDER; order >= 0; --order)
+    {
+        if (free_lists[order])
+        {
+            return order;
+        }
+    }
+    return -1;
+}
+
+size_t BuddyAllocator::index_of(const void* block) const
+{
+    return (reinterpret_cast<uintptr_t>(block) - base) / BYTES_PER_FRAME;
+}
+
+void* BuddyAllocator::block_at(const size_t index) const
+{
+    return reinterpret_cast<void*>(base + index * BYTES_PER_FRAME);
+}
+
+void BuddyAllocator::push_free(const size_t index, const int order)
+{
+    const auto block = static_cast<FreeBlock*>(block_at(index));
+    block->prev = nullptr;
+    block->next = free_lists[order];
+    if (block->next)
+    {
+        block->next->prev = block;
+    }
+    free_lists[order] = block;
+    states[index] = FREE_FLAG | order;
+    ++free_counts[order];
+    free_frames_ += static_cast<size_t>(1) << order;
+}
+
+void BuddyAllocator::remove_free(const size_t index, const int order)
+{
+    const auto block = static_cast<FreeBlock*>(block_at(index));
+    if (block->prev)
+    {
+        block->prev->next = block->next;
+    }
+    else
+    {
+        free_lists[order] = block->next;
+    }
+    if (block->next)
+    {
+        block->next->prev = block->prev;
+    }
+    states[index] = NOT_HEAD;
+    --free_counts[order];
+    free_frames_ -= static_cast<size_t>(1) << order;
+}
@@ -0,0 +1,96 @@
+#ifndef BUDDY_HPP
+#define BUDDY_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+#include "frame_manager.hpp"
+
+/**
+ * @file buddy.hpp
+ *
+ * DMA 用の，物理的に連続したメモリを確保するバディアロケータ．
+ */
+
+/**
+ * 2^order フレームのブロックを単位にメモリを割り当てる．
+ *
+ * 管理領域は FrameManager から最大ブロックの大きさに揃えて切り出すので，どのブロックも
+ * 自分の大きさで整列している．したがって大きさ以下の2の冪の境界をまたぐことはなく，
+ * xHCI のリングのような「64KiB 境界をまたいではならない」領域もそのまま割り当てられる．
+ * 解放時は相方（バディ）が空いていれば併合を繰り返すので O(log n) で済む．
+ * 空きブロックのリストはブロック自体の先頭に置く（物理アドレスと仮想アドレスが一致する前提）．
+ */
+class BuddyAllocator
+{
+public:
+    static constexpr int MAX_ORDER = 10; // 4MiB
+
+    // 最大ブロック max_blocks 個分の領域を frames から切り出す．取れなければ個数を減らして試す
+    Error initialize(FrameManager& frames, size_t max_blocks);
+    // 最初に確保されたときに initialize(frames, max_blocks) を行う．使われるまでは領域を切り出さない
+    void initialize_on_first_use(FrameManager& frames, size_t max_blocks);
+
+    // 2^order フレームのブロックを確保する
+    WithError<void*> allocate_order(int order);
+    // bytes バイト以上の領域を確保する．先頭は alignment に揃い，boundary（0 なら制約なし）の倍数の
+    // アドレスをまたがない．alignment と boundary は2の冪
+    WithError<void*> allocate(size_t bytes, size_t alignment = BYTES_PER_FRAME, size_t boundary = 0);
+    void free(void* block);
+
+    [[nodiscard]] size_t free_frames() const
+    {
+        return free_frames_;
+    }
+
+    [[nodiscard]] size_t free_blocks(const int order) const
+    {
+        return free_counts[order];
+    }
+
+    // 空いている最大のブロックの order．空きがなければ -1
+    [[nodiscard]] int largest_free_order() const;
+
+    void* operator new(size_t size, void* buf)
+    {
+        return buf;
+    }
+
+    void operator delete(void* obj) noexcept
+    {
+    }
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock* next;
+        FreeBlock* prev;
+    };
+
+    // ブロックの先頭フレームの状態．空きなら FREE_FLAG | order，使用中なら order
+    static constexpr uint8_t FREE_FLAG = 0x80;
+    static constexpr uint8_t NOT_HEAD = 0x7f;
+
+    [[nodiscard]] size_t index_of(const void* block) const;
+    [[nodiscard]] void* block_at(size_t index) const;
+    void push_free(size_t index, int order);
+    void remove_free(size_t index, int order);
+
+    // initialize_on_first_use() で渡され，まだ領域を切り出していなければnullptrでない
+    FrameManager* deferred_frames = nullptr;
+    size_t deferred_blocks = 0;
+
+    uintptr_t base = 0;
+    size_t num_frames = 0;
+    uint8_t* states = nullptr;
+    std::array<FreeBlock*, MAX_ORDER + 1> free_lists{};
+    std::array<size_t, MAX_ORDER + 1> free_counts{};
+    size_t free_frames_ = 0;
+};
+
+// デバイスとの DMA に使う領域のアロケータ
+extern BuddyAllocator* dma_allocator;
+
+#endif //BUDDY_HPP
@@ -3,6 +3,7 @@
 #include <cstring>
 
 #include "font.hpp"
+#include "interrupt.hpp"
 
 void Console::put_string(const char* s)
 {
@@ -11,15 +12,89 @@ void Console::put_string(const char* s)
         if (*s == '\n')
         {
             newline();
+            ++s;
+            continue;
         }
-        else if (cursor_column < COLUMNS - 1)
+
+        // 改行までの文字を行に収まる分だけまとめて書き込む
+        int len = 0;
+        while (s[len] != '\0' && s[len] != '\n')
         {
-            write_ascii(writer, 8 * cursor_column, 16 * cursor_row, *s, fg_color);
-            buffer[cursor_row][cursor_column] = *s;
-            ++cursor_column;
+            ++len;
         }
-        ++s;
+        const int n = len < COLUMNS - 1 - cursor_column ? len : COLUMNS - 1 - cursor_column;
+        if (n > 0)
+        {
+            memcpy(&line(cursor_row)[cursor_column], s, n);
+            cursor_column += n;
+            if (cursor_row < dirty_from)
+            {
+                dirty_from = cursor_row;
+            }
+        }
+        s += len;
+    }
+}
+
+void Console::render()
+{
+    // 他のタスクが put_string() で書き足す分を取りこぼさないよう，変更を取り出して空にするまでを一度に行う
+    auto rflags = save_and_disable_interrupts();
+    const int scroll = pending_scroll;
+    const int dirty = dirty_from;
+    const int last_row = cursor_row;
+    pending_scroll = 0;
+    dirty_from = ROWS;
+    restore_interrupts(rflags);
+
+    if (scroll == 0 && dirty == ROWS)
+    {
+        return;
+    }
+
+    int first_row = dirty;
+    if (scroll >= ROWS)
+    {
+        // 画面の行がすべて入れ替わったので，最終的な内容だけを描く
+        first_row = 0;
+    }
+    else if (scroll > 0)
+    {
+        // 溜まったスクロールを1回の移動で反映する．空いた行は dirty 以降に含まれている
+        writer.move_rect({0, 0}, {{0, 16 * scroll}, {8 * COLUMNS, 16 * (ROWS - scroll)}});
+    }
+
+    for (int row = first_row; row <= last_row; ++row)
+    {
+        render_line(row);
+    }
+
+    if (layer_manager)
+    {
+        const int top = scroll > 0 ? 0 : first_row;
+        layer_manager->draw(layer_id, {{0, 16 * top}, {8 * COLUMNS, 16 * (last_row - top + 1)}});
+    }
+
+    // 描いている間にスクロールしていれば，描いた行はすでにずれたリングから読んでいるので，
+    // 次の移動で正しい位置にならない．次回はすべての行を描き直す
+    rflags = save_and_disable_interrupts();
+    if (pending_scroll > 0)
+    {
+        pending_scroll = 0;
+        dirty_from = 0;
     }
+    restore_interrupts(rflags);
+}
+
+void Console::set_layer(LayerManager* layer_manager, const unsigned int layer_id)
+{
+    this->layer_manager = layer_manager;
+    this->layer_id = layer_id;
+}
+
+void Console::set_repaint_on_scroll(const bool repaint)
+{
+    repaint_on_scroll = repaint;
 }
 
 void Console::newline()
@@ -28,23 +103,53 @@ void Console::newline()
     if (cursor_row < ROWS - 1)
     {
         ++cursor_row;
+        return;
     }
-    else
+
+    // 行のリングを1行進めるだけで，描画は render() まで遅らせる
+    top_line = (top_line + 1) % ROWS;
+    memset(line(ROWS - 1), 0, COLUMNS + 1);
+    if (repaint_on_scroll)
     {
-        for (int y = 0; y < 16 * ROWS; ++y)
-        {
-            for (int x = 0; x < 8 * COLUMNS; ++x)
-            {
-                writer.write(x, y, bg_color);
-            }
-        }
-        for (int row = 0; row < ROWS - 1; ++row)
+        repaint();
+        return;
+    }
+    ++pending_scroll;
+    // 描き直しが必要な行も1行上にずれ，空いた最終行も描き直しが必要になる
+    dirty_from = dirty_from > 0 ? (dirty_from < ROWS ? dirty_from - 1 : ROWS - 1) : 0;
+}
+
+void Console::repaint()
+{
+    for (int y = 0; y < 16 * ROWS; ++y)
+    {
+        for (int x = 0; x < 8 * COLUMNS; ++x)
         {
-            memcpy(buffer[row], buffer[row + 1], COLUMNS + 1);
-            write_string(writer, 0, 16 * row, buffer[row], fg_color);
+            writer.write(x, y, bg_color);
         }
-        memset(buffer[ROWS - 1], 0, COLUMNS + 1);
     }
+    for (int row = 0; row < ROWS - 1; ++row)
+    {
+        render_line(row);
+    }
+    if (layer_manager)
+    {
+        layer_manager->draw(layer_id, {{0, 0}, {8 * COLUMNS, 16 * ROWS}});
+    }
+    // 最終行は消したばかりなので，描き直す必要はない
+    dirty_from = ROWS;
+    pending_scroll = 0;
 }
 
+char* Console::line(const int row)
+{
+    return buffer[(top_line + row) % ROWS];
+}
 
+void Console::render_line(const int row)
+{
+    const char* text = line(row);
+    const int len = static_cast<int>(strlen(text));
+    glyph_cache.write_chars(writer, 0, 16 * row, text, len);
+    fill_rectangle(writer, {8 * len, 16 * row}, {8 * (COLUMNS - len), 16}, bg_color);
+}
@@ -2,7 +2,9 @@
 #ifndef CONSOLE_HPP
 #define CONSOLE_HPP
 
+#include "font.hpp"
 #include "graphics.hpp"
+#include "layer.hpp"
 
 class Console
 {
@@ -11,12 +13,21 @@ public:
     static constexpr int COLUMNS = 80;
 
     Console(PixelWriter& writer, const PixelColor& fg_color, const PixelColor& bg_color)
-        : writer(writer), fg_color(fg_color), bg_color(bg_color),
-          buffer{}, cursor_row{0}, cursor_column{0}
+        : writer(writer), fg_color(fg_color), bg_color(bg_color), glyph_cache(writer, fg_color, bg_color),
+          buffer{}, top_line{0}, cursor_row{0}, cursor_column{0}, pending_scroll{0}, dirty_from{ROWS},
+          layer_manager{nullptr}, layer_id{0}, repaint_on_scroll{false}
     {
     }
 
+    // 文字列を行バッファに書き込む．描画は行わず，次の render() でまとめて行う
     void put_string(const char* s);
+    // 前回の render() 以降の変更を描く．スクロールは何行分溜まっていても1回の移動で済ませる
+    void render();
+    // writer がレイヤーのウィンドウのものなら，書き込んだ部分をそのレイヤーとして画面に描き直す
+    void set_layer(LayerManager* layer_manager, unsigned int layer_id);
+    // trueにすると，改行でスクロールする度にその場で全体を消して全行を描き直す（行を移す前の描き方）
+    // 起動時の計測で新旧の描き方を比べるために使う
+    void set_repaint_on_scroll(bool repaint);
 
     void* operator new(size_t size, void* buf)
     {
@@ -29,13 +40,27 @@ public:
 
 private:
     void newline();
+    // 画面上の行rowの文字を格納している buffer の行
+    char* line(int row);
+    void render_line(int row);
+    void repaint();
 
     PixelWriter& writer;
     const PixelColor& fg_color;
     const PixelColor& bg_color;
+    GlyphCache glyph_cache;
+    // 行のリングバッファ．画面の先頭行は buffer[top_line]
     char buffer[ROWS][COLUMNS + 1];
+    int top_line;
     int cursor_row;
     int cursor_column;
+    // 描画に反映していないスクロールの行数
+    int pending_scroll;
+    // この行以降は行バッファから描き直す必要がある．ROWSなら描き直す行はない
+    int dirty_from;
+    LayerManager* layer_manager;
+    unsigned int layer_id;
+    bool repaint_on_scroll;
 };
 
 
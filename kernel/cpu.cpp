@@ -0,0 +1,246 @@
+#include "cpu.hpp"
+
+#include <cstring>
+
+#include "acpi.hpp"
+#include "asmfunc.hpp"
+#include "idle.hpp"
+#include "interrupt.hpp"
+#include "logger.hpp"
+#include "paging.hpp"
+#include "timing.hpp"
+#include "workqueue.hpp"
+
+namespace
+{
+    constexpr uint32_t IA32_GS_BASE = 0xc0000101;
+
+    // Local APIC のレジスタ
+    constexpr uintptr_t LOCAL_APIC_ID = LOCAL_APIC_BASE + 0x20;
+    constexpr uintptr_t SPURIOUS_INTERRUPT_VECTOR = LOCAL_APIC_BASE + 0xf0;
+    constexpr uintptr_t INTERRUPT_COMMAND_LOW = LOCAL_APIC_BASE + 0x300;
+    constexpr uintptr_t INTERRUPT_COMMAND_HIGH = LOCAL_APIC_BASE + 0x310;
+
+    // ICR の下位: 配送モード（ビット10:8），送信中（ビット12），アサート（ビット14）
+    constexpr uint32_t ICR_INIT = 0x5u << 8 | 1u << 14;
+    constexpr uint32_t ICR_STARTUP = 0x6u << 8 | 1u << 14;
+    constexpr uint32_t ICR_FIXED = 1u << 14;
+    constexpr uint32_t ICR_SEND_PENDING = 1u << 12;
+
+    // トランポリンの ApTrampolineParams に書き込む値．asmfunc.asm の並びと合わせる
+    struct TrampolineParams
+    {
+        uint64_t cr3;
+        uint64_t stack;
+        uint64_t entry;
+        uint64_t argument;
+    };
+
+    CPU* cpus[acpi::MAX_PROCESSORS];
+    // 他のコアも読むので，cpus に書いてから増やす
+    std::atomic<int> num_cpus{0};
+
+    volatile uint32_t& local_apic_register(const uintptr_t address)
+    {
+        return *reinterpret_cast<volatile uint32_t*>(address);
+    }
+
+    uint8_t local_apic_id()
+    {
+        return local_apic_register(LOCAL_APIC_ID) >> 24;
+    }
+
+    void spin_wait_us(const uint64_t us)
+    {
+        const uint64_t end = timing::now() + timing::frequency() * us / 1'000'000;
+        while (timing::now() < end)
+        {
+            __builtin_ia32_pause();
+        }
+    }
+
+    void send_ipi(const uint8_t apic_id, const uint32_t command)
+    {
+        // 上位と下位を書く間に割り込みハンドラが別の宛先を書き込まないようにする
+        const auto rflags = save_and_disable_interrupts();
+        local_apic_register(INTERRUPT_COMMAND_HIGH) = static_cast<uint32_t>(apic_id) << 24;
+        local_apic_register(INTERRUPT_COMMAND_LOW) = command;
+        while (local_apic_register(INTERRUPT_COMMAND_LOW) & ICR_SEND_PENDING)
+        {
+            __builtin_ia32_pause();
+        }
+        restore_interrupts(rflags);
+    }
+
+    // GDT/TSS をロードし，GS のベースを cpu にする
+    void setup_this_cpu(CPU& cpu)
+    {
+        setup_segments(cpu.gdt, cpu.tss, reinterpret_cast<uint64_t>(cpu.stack + cpu.stack_size));
+        WriteMSR(IA32_GS_BASE, reinterpret_cast<uint64_t>(&cpu));
+    }
+
+    // トランポリンを置く，1MiB 未満で 4KiB に収まる空きページを探す．見つからなければ0
+    uintptr_t find_trampoline_page(const MemoryMap& memory_map)
+    {
+        constexpr uintptr_t LOW_MEMORY_END = 1024 * 1024;
+        const auto base = reinterpret_cast<uintptr_t>(memory_map.buffer);
+        for (auto iter = base; iter < base + memory_map.map_size; iter += memory_map.descriptor_size)
+        {
+            const auto desc = reinterpret_cast<const MemoryDescriptor*>(iter);
+            if (!is_available(static_cast<MemoryType>(desc->type)))
+            {
+                continue;
+            }
+            // 0番地のページは実モードの割り込みベクタなどに使われていることがあるので避ける
+            const uintptr_t start = desc->physical_start < UEFI_PAGE_SIZE ? UEFI_PAGE_SIZE : desc->physical_start;
+            const uintptr_t end = desc->physical_start + desc->number_of_pages * UEFI_PAGE_SIZE;
+            if (start + UEFI_PAGE_SIZE <= end && start + UEFI_PAGE_SIZE <= LOW_MEMORY_END)
+            {
+                return start;
+            }
+        }
+        return 0;
+    }
+
+    // AP が 64 ビットモードに入って最初に呼ばれる
+    [[noreturn]] void ap_main(CPU* cpu)
+    {
+        paging::setup_application_processor();
+        setup_this_cpu(*cpu);
+        LoadIDT(sizeof(idt) - 1, reinterpret_cast<uintptr_t>(&idt[0]));
+
+        // Local APIC を有効にする（スプリアス割り込みのベクタは 0xff）
+        local_apic_register(SPURIOUS_INTERRUPT_VECTOR) |= 0x1ffu;
+        workqueue::initialize_this_cpu();
+
+        cpu->idle_reported_at = timing::now();
+        cpu->online.store(true, std::memory_order_release);
+
+        __asm__ volatile("sti" ::: "memory");
+        while (true)
+        {
+            if (!cpu->dispatcher.has_work())
+            {
+                idle::wait_for_work(cpu->dispatcher);
+                continue;
+            }
+            cpu->dispatcher.dispatch();
+        }
+    }
+
+    // INIT-SIPI-SIPI で cpu を起動し，online になるのを待つ
+    Error boot_application_processor(CPU& cpu, const uintptr_t trampoline)
+    {
+        TrampolineParams params{
+            GetCR3(),
+            reinterpret_cast<uint64_t>(cpu.stack + cpu.stack_size),
+            reinterpret_cast<uint64_t>(ap_main),
+            reinterpret_cast<uint64_t>(&cpu),
+        };
+        memcpy(reinterpret_cast<void*>(trampoline + (ApTrampolineParams - ApTrampolineStart)),
+               &params, sizeof(params));
+
+        const uint64_t start = timing::now();
+        send_ipi(cpu.apic_id, ICR_INIT);
+        spin_wait_us(10'000);
+        // 1回目の SIPI を取りこぼすコアがあるので，起動していなければもう1度送る
+        const uint32_t startup = ICR_STARTUP | static_cast<uint32_t>(trampoline >> 12);
+        send_ipi(cpu.apic_id, startup);
+        spin_wait_us(200);
+        if (!cpu.online.load(std::memory_order_acquire))
+        {
+            send_ipi(cpu.apic_id, startup);
+        }
+
+        const uint64_t deadline = start + timing::frequency() * cpu::AP_BOOT_TIMEOUT_MS / 1000;
+        while (!cpu.online.load(std::memory_order_acquire))
+        {
+            if (timing::now() > deadline)
+            {
+                return MAKE_ERROR(Error::kTimeout);
+            }
+            __builtin_ia32_pause();
+        }
+        cpu.boot_latency = timing::now() - start;
+        return MAKE_ERROR(Error::kSuccess);
+    }
+}
+
+namespace cpu
+{
+    void initialize_bsp(uint8_t* stack, const size_t stack_size)
+    {
+        auto bsp = new CPU;
+        bsp->self = bsp;
+        bsp->index = 0;
+        bsp->apic_id = local_apic_id();
+        bsp->stack = stack;
+        bsp->stack_size = stack_size;
+        bsp->online.store(true, std::memory_order_relaxed);
+        setup_this_cpu(*bsp);
+
+        cpus[0] = bsp;
+        num_cpus.store(1, std::memory_order_release);
+    }
+
+    Error start_application_processors(const MemoryMap& memory_map)
+    {
+        if (acpi::num_processors() <= 1)
+        {
+            return MAKE_ERROR(Error::kSuccess);
+        }
+
+        const uintptr_t trampoline = find_trampoline_page(memory_map);
+        if (trampoline == 0)
+        {
+            return MAKE_ERROR(Error::kNoEnoughMemory);
+        }
+        memcpy(reinterpret_cast<void*>(trampoline), ApTrampolineStart, ApTrampolineEnd - ApTrampolineStart);
+
+        const uint8_t bsp_apic_id = cpus[0]->apic_id;
+        for (int i = 0; i < acpi::num_processors() && count() < acpi::MAX_PROCESSORS; ++i)
+        {
+            const uint8_t apic_id = acpi::processor_apic_id(i);
+            if (apic_id == bsp_apic_id)
+            {
+                continue;
+            }
+
+            auto cpu = new CPU;
+            cpu->self = cpu;
+            cpu->index = count();
+            cpu->apic_id = apic_id;
+            cpu->stack = new uint8_t[AP_STACK_SIZE];
+            cpu->stack_size = AP_STACK_SIZE;
+
+            // トランポリンの引数は共有なので，1つずつ起動を待つ
+            if (auto err = boot_application_processor(*cpu, trampoline))
+            {
+                // 遅れて動き出すと次の AP と引数を取り合うので，ここで起動をやめる．CPU も解放しない
+                log(kError, "cpu: apic id %u did not start: %s\n", apic_id, err.Name());
+                break;
+            }
+            cpus[cpu->index] = cpu;
+            num_cpus.store(cpu->index + 1, std::memory_order_release);
+            log(kInfo, "cpu %d: apic id %u, online in %lu us\n",
+                cpu->index, apic_id, timing::to_nanoseconds(cpu->boot_latency) / 1000);
+        }
+        log(kInfo, "cpu: %d of %d processors online\n", count(), acpi::num_processors());
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    void send_interrupt(const CPU& target, const uint8_t vector)
+    {
+        send_ipi(target.apic_id, ICR_FIXED | vector);
+    }
+
+    int count()
+    {
+        return num_cpus.load(std::memory_order_acquire);
+    }
+
+    CPU& at(const int i)
+    {
+        return *cpus[i];
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef CPU_HPP
+#define CPU_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+#include "event.hpp"
+#include "memory_map.hpp"
+#include "segment.hpp"
+#include "workqueue.hpp"
+
+/**
+ * @file cpu.hpp
+ *
+ * コア毎のデータと，AP（BSP 以外のコア）の起動．
+ *
+ * 各コアの GS のベースは自分の CPU を指すので，this_cpu() はメモリを1回読むだけで済む．
+ * AP は ACPI の MADT に載っているものを INIT-SIPI-SIPI で1つずつ起動し，
+ * 自分のスタック，GDT/TSS，EventDispatcher で独立したイベントループを回す．
+ *
+ * 不変 TSC がなく timing が Local APIC タイマーで代用しているときは，
+ * AP の timing::now() は意味を持たない（代用の時計は BSP のタイマーを読む）．
+ */
+
+struct CPU
+{
+    // GS:0 に置く自分自身へのポインタ
+    CPU* self = nullptr;
+    int index = 0;
+    uint8_t apic_id = 0;
+    std::atomic<bool> online{false};
+    // 起動を要求してから online になるまでの時間（timing::now() の単位）
+    uint64_t boot_latency = 0;
+
+    // このコアで idle::wait_for_work() が眠っていた時間．idle::report() が読んで0に戻す
+    std::atomic<uint64_t> idle_counts{0};
+    uint64_t idle_reported_at = 0;
+
+    EventDispatcher dispatcher;
+    // このコアが積んだ仕事．他のコアからも盗まれる
+    WorkDeque work_deque;
+
+    alignas(16) GlobalDescriptorTable gdt;
+    TaskStateSegment tss;
+    // このコアのスタック．BSP では kernel_main_stack を指す
+    uint8_t* stack = nullptr;
+    size_t stack_size = 0;
+};
+
+namespace cpu
+{
+    // AP 毎に確保するスタックの大きさ
+    constexpr size_t AP_STACK_SIZE = 64 * 1024;
+    // SIPI を送ってから AP が起動するのを待つ時間
+    constexpr uint64_t AP_BOOT_TIMEOUT_MS = 100;
+
+    // BSP の CPU を作り，GDT/TSS と GS のベースを設定する．ヒープを初期化した後，IDT を設定する前に呼ぶ
+    void initialize_bsp(uint8_t* stack, size_t stack_size);
+
+    /**
+     * ACPI の MADT に載っている AP を1つずつ起動し，それぞれの起動にかかった時間をログに出す．
+     * timing と idle を初期化した後に呼ぶ．AP の起動中はヒープを使うのは BSP だけでなければならない．
+     * memory_map はトランポリンを置く 1MiB 未満のページを探すのに使う．
+     */
+    Error start_application_processors(const MemoryMap& memory_map);
+
+    // target のコアに vector の割り込みを送る（Fixed，物理宛先）
+    void send_interrupt(const CPU& target, uint8_t vector);
+
+    // 登録済みのコアの数（BSP を含む）と i 番目のコア．BSP は0番目
+    [[nodiscard]] int count();
+    [[nodiscard]] CPU& at(int i);
+}
+
+[[nodiscard]] inline CPU& this_cpu()
+{
+    CPU* cpu;
+    __asm__ volatile("movq %%gs:0, %0" : "=r"(cpu));
+    return *cpu;
+}
+
+#endif //CPU_HPP
@@ -30,6 +30,10 @@ public:
         kUnknownXHCISpeedID,
         kNoWaiter,
         kNoPCIMSI,
+        kNoSerialPort,
+        kInvalidArgument,
+        kInvalidACPITable,
+        kTimeout,
         kLastOfCode, // この列挙子は常に最後に配置する
     };
 
@@ -56,6 +60,10 @@ private:
         "kUnknownXHCISpeedID",
         "kNoPCIMSI",
         "kNoWaiter",
+        "kNoSerialPort",
+        "kInvalidArgument",
+        "kInvalidACPITable",
+        "kTimeout",
     };
     static_assert(Error::Code::kLastOfCode == code_names_.size());
 
@@ -0,0 +1,100 @@
+#include "event.hpp"
+
+#include "interrupt.hpp"
+#include "logger.hpp"
+
+void EventDispatcher::set_handler(const Message::Type type, const Priority priority, const Handler handler)
+{
+    handlers[static_cast<int>(type)] = handler;
+    priorities[static_cast<int>(type)] = priority;
+}
+
+void EventDispatcher::notify(const Message::Type type)
+{
+    const int t = static_cast<int>(type);
+    wake.pending[priorities[t]].fetch_or(1u << t, std::memory_order_release);
+}
+
+Error EventDispatcher::post(const Message& msg)
+{
+    // キューは書き込み側が1つの前提なので，メインループから書き込むときは割り込みハンドラと
+    // 重ならないようにする．割り込みハンドラの中では既に割り込みは禁止されている
+    const auto rflags = save_and_disable_interrupts();
+    auto err = queues[priorities[static_cast<int>(msg.type)]].push(msg);
+    restore_interrupts(rflags);
+
+    if (err)
+    {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return err;
+    }
+    wake.posted.fetch_add(1, std::memory_order_release);
+    return err;
+}
+
+bool EventDispatcher::has_work() const
+{
+    return has_work_above(kNumPriorities);
+}
+
+bool EventDispatcher::has_work_above(const Priority priority) const
+{
+    for (int p = 0; p < priority; ++p)
+    {
+        if (wake.pending[p].load(std::memory_order_acquire) != 0 || queues[p].count() != 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void EventDispatcher::handle(const Message& msg) const
+{
+    if (const auto handler = handlers[static_cast<int>(msg.type)])
+    {
+        handler(msg);
+    }
+    else
+    {
+        log(kError, "Unknown message type: %d\n", static_cast<int>(msg.type));
+    }
+}
+
+void EventDispatcher::run_notifications(const Priority priority)
+{
+    uint32_t bits = wake.pending[priority].exchange(0, std::memory_order_acquire);
+    while (bits)
+    {
+        const int t = __builtin_ctz(bits);
+        bits &= bits - 1;
+        handle(Message{static_cast<Message::Type>(t), {}});
+    }
+}
+
+void EventDispatcher::dispatch(const uint64_t budget_cycles)
+{
+    int p = kHigh;
+    while (p < kNumPriorities)
+    {
+        const auto priority = static_cast<Priority>(p);
+        run_notifications(priority);
+
+        const uint64_t deadline = __builtin_ia32_rdtsc() + budget_cycles;
+        bool preempted = false;
+        while (queues[p].count() != 0)
+        {
+            const Message msg = queues[p].front();
+            queues[p].pop();
+            handle(msg);
+
+            // 期限を過ぎていて，より優先度の高い仕事が来ていればそちらへ戻る
+            if (__builtin_ia32_rdtsc() >= deadline && has_work_above(priority))
+            {
+                preempted = true;
+                break;
+            }
+        }
+        p = preempted ? kHigh : p + 1;
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef EVENT_HPP
+#define EVENT_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+#include "message.hpp"
+#include "queue.hpp"
+
+/**
+ * 複数の発生源からのメッセージを優先度順に配送する．
+ *
+ * 発生源は2通りの方法でメッセージを届ける．
+ * - notify(): 「xHCにイベントがある」のように何度来ても1回処理すればよい通知．
+ *   種類毎の保留ビットを立てるだけなので，キューが溢れて失われることがない．
+ * - post(): シリアルポートで受信した文字のように，1つずつ内容を持つメッセージ．優先度毎のキューに入れる．
+ *
+ * dispatch() は起床1回で処理可能なものをすべて優先度の高い順に処理する．
+ * 低い優先度のメッセージを処理している間に期限を過ぎ，高い優先度の仕事が来ていれば，
+ * そちらを先に処理するので，大量の低優先度メッセージが入力を待たせ続けることはない．
+ */
+class EventDispatcher
+{
+public:
+    enum Priority
+    {
+        kHigh, // 入力
+        kNormal, // デバイス，タイマー
+        kLow,
+        kNumPriorities,
+    };
+
+    using Handler = void (*)(const Message& msg);
+
+    static constexpr size_t QUEUE_SIZE = 64;
+    // 低い優先度の処理を続けてよい時間（TSCのサイクル数）
+    static constexpr uint64_t DEFAULT_BUDGET_CYCLES = 2'000'000;
+
+    void set_handler(Message::Type type, Priority priority, Handler handler);
+
+    // 割り込みハンドラからも呼べる
+    void notify(Message::Type type);
+    // 割り込みハンドラからも呼べる．キューが一杯なら捨てて数える
+    Error post(const Message& msg);
+
+    [[nodiscard]] bool has_work() const;
+    void dispatch(uint64_t budget_cycles = DEFAULT_BUDGET_CYCLES);
+
+    // 通知や投函のたびに書き込まれるキャッシュライン．MONITOR で見張れば新しい仕事が来たときに起きられる
+    [[nodiscard]] const void* wake_address() const
+    {
+        return &wake;
+    }
+
+    [[nodiscard]] uint64_t dropped() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr int NUM_TYPES = static_cast<int>(Message::Type::kLastOfType);
+
+    void handle(const Message& msg) const;
+    // 優先度 priority の保留中の通知をすべて処理する
+    void run_notifications(Priority priority);
+    [[nodiscard]] bool has_work_above(Priority priority) const;
+
+    std::array<Handler, NUM_TYPES> handlers{};
+    std::array<Priority, NUM_TYPES> priorities{};
+    struct alignas(64) WakeLine
+    {
+        // 優先度毎の，通知の保留ビット（ビット番号は Message::Type）
+        std::array<std::atomic<uint32_t>, kNumPriorities> pending{};
+        // post() の回数．キューの書き込み位置は別のキャッシュラインにあるので，ここにも書いて知らせる
+        std::atomic<uint32_t> posted{0};
+    } wake;
+    std::array<SPSCQueue<Message, QUEUE_SIZE>, kNumPriorities> queues;
+    std::atomic<uint64_t> dropped_{0};
+};
+
+#endif //EVENT_HPP
@@ -1,12 +1,14 @@
 #include "font.hpp"
 
+#include <cstring>
+
 extern const uint8_t _binary_hankaku_bin_start;
 extern const uint8_t _binary_hankaku_bin_end;
 extern const uint8_t _binary_hankaku_bin_size;
 
 const uint8_t* get_font(const char c)
 {
-    const auto index = 16 * static_cast<unsigned int>(c);
+    const auto index = 16 * static_cast<unsigned int>(static_cast<uint8_t>(c));
     if (index >= reinterpret_cast<uintptr_t>(&_binary_hankaku_bin_size))
     {
         return nullptr;
@@ -21,23 +23,56 @@ void write_ascii(PixelWriter& writer, const int x, const int y, const char c, co
     {
         return;
     }
-    for (int dy = 0; dy < 16; ++dy)
+    writer.write_bitmap(x, y, font, 8, 16, writer.to_pixel(color));
+}
+
+void write_string(PixelWriter& writer, const int x, const int y, const char* s, const PixelColor& color)
+{
+    for (int i = 0; s[i] != '\0'; ++i)
+    {
+        write_ascii(writer, x + 8 * i, y, s[i], color);
+    }
+}
+
+
+GlyphCache::GlyphCache(const PixelWriter& writer, const PixelColor& fg_color, const PixelColor& bg_color)
+    : glyphs{}
+{
+    const uint32_t fg = writer.to_pixel(fg_color);
+    const uint32_t bg = writer.to_pixel(bg_color);
+    for (int c = 0; c < NUM_GLYPHS; ++c)
     {
-        for (int dx = 0; dx < 8; ++dx)
+        const uint8_t* font = get_font(static_cast<char>(c));
+        for (int dy = 0; dy < GLYPH_HEIGHT; ++dy)
         {
-            if (font[dy] << dx & 0x80u)
+            const uint8_t bits = font ? font[dy] : 0;
+            for (int dx = 0; dx < GLYPH_WIDTH; ++dx)
             {
-                writer.write(x + dx, y + dy, color);
+                glyphs[c][dy][dx] = bits << dx & 0x80u ? fg : bg;
             }
         }
     }
 }
 
-void write_string(PixelWriter& writer, const int x, const int y, const char* s, const PixelColor& color)
+void GlyphCache::write_chars(PixelWriter& writer, const int x, const int y, const char* s, const int len) const
 {
-    for (int i = 0; s[i] != '\0'; ++i)
+    uint32_t row[GLYPH_WIDTH * MAX_CHARS_PER_WRITE];
+    for (int done = 0; done < len; done += MAX_CHARS_PER_WRITE)
     {
-        write_ascii(writer, x + 8 * i, y, s[i], color);
+        const int n = len - done < MAX_CHARS_PER_WRITE ? len - done : MAX_CHARS_PER_WRITE;
+        for (int dy = 0; dy < GLYPH_HEIGHT; ++dy)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                const auto c = static_cast<uint8_t>(s[done + i]);
+                memcpy(&row[GLYPH_WIDTH * i], glyphs[c][dy], sizeof(glyphs[c][dy]));
+            }
+            writer.write_row(x + GLYPH_WIDTH * done, y + dy, row, GLYPH_WIDTH * n);
+        }
     }
 }
 
+void GlyphCache::write_string(PixelWriter& writer, const int x, const int y, const char* s) const
+{
+    write_chars(writer, x, y, s, static_cast<int>(strlen(s)));
+}
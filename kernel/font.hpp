@@ -9,5 +9,31 @@
 void write_ascii(PixelWriter& writer, int x, int y, char c, const PixelColor& color);
 void write_string(PixelWriter& writer, int x, int y, const char* s, const PixelColor& color);
 
+/**
+ * 256文字分のグリフを，前景色と背景色で塗り分けたピクセル列に展開しておくキャッシュ．
+ *
+ * ピクセルは生成時に渡した PixelWriter の形式に変換済みなので，1文字は8ピクセルの行を
+ * 16回コピーするだけで描ける．文字列は走査線毎に全文字分の行をつなげてから書き出す．
+ */
+class GlyphCache
+{
+public:
+    static constexpr int GLYPH_WIDTH = 8;
+    static constexpr int GLYPH_HEIGHT = 16;
+
+    GlyphCache(const PixelWriter& writer, const PixelColor& fg_color, const PixelColor& bg_color);
+
+    // s[0..len) を (x, y) から背景色ごと描く
+    void write_chars(PixelWriter& writer, int x, int y, const char* s, int len) const;
+    void write_string(PixelWriter& writer, int x, int y, const char* s) const;
+
+private:
+    static constexpr int NUM_GLYPHS = 256;
+    // 1回の書き出しでつなげる最大の文字数
+    static constexpr int MAX_CHARS_PER_WRITE = 80;
+
+    uint32_t glyphs[NUM_GLYPHS][GLYPH_HEIGHT][GLYPH_WIDTH];
+};
+
 
 #endif //FONT_HPP
@@ -5,6 +5,15 @@
 enum PixelFormat {
     kPixelRGBResv8BitPerColor,
     kPixelBGRResv8BitPerColor,
+    kPixelBitMask,
+};
+
+// kPixelBitMask のときに各色が32ビットのピクセル中で占めるビット
+struct PixelBitMask {
+    uint32_t red_mask;
+    uint32_t green_mask;
+    uint32_t blue_mask;
+    uint32_t reserved_mask;
 };
 
 struct FrameBufferConfig {
@@ -13,6 +22,7 @@ struct FrameBufferConfig {
     uint32_t horizontal_resolution;
     uint32_t vertical_resolution;
     enum PixelFormat pixel_format;
+    struct PixelBitMask pixel_bitmask;
 };
 
 #define PT_NULL    0
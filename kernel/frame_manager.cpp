@@ -0,0 +1,268 @@
+#include "frame_manager.hpp"
+
+#include <cstring>
+
+namespace
+{
+    // 1MiB 未満は AP の起動コードなどのために空けておく
+    constexpr uintptr_t LOW_MEMORY_END = 0x100000;
+
+    constexpr size_t words_for(const size_t bits)
+    {
+        return (bits + 63) / 64;
+    }
+
+    template <typename F>
+    void for_each_available(const MemoryMap& memory_map, F f)
+    {
+        const auto base = reinterpret_cast<uintptr_t>(memory_map.buffer);
+        for (auto iter = base; iter < base + memory_map.map_size; iter += memory_map.descriptor_size)
+        {
+            const auto desc = reinterpret_cast<const MemoryDescriptor*>(iter);
+            if (is_available(static_cast<MemoryType>(desc->type)))
+            {
+                f(*desc);
+            }
+        }
+    }
+}
+
+Error FrameManager::initialize(const MemoryMap& memory_map)
+{
+    uintptr_t memory_end = 0;
+    for_each_available(memory_map, [&](const MemoryDescriptor& desc)
+    {
+        const uintptr_t end = desc.physical_start + desc.number_of_pages * UEFI_PAGE_SIZE;
+        if (end > memory_end)
+        {
+            memory_end = end;
+        }
+    });
+
+    num_frames = memory_end / BYTES_PER_FRAME;
+    size_t bitmap_words = 0;
+    size_t bits = num_frames;
+    for (int level = 0; level < LEVELS; ++level)
+    {
+        level_bits[level] = bits;
+        bitmap_words += words_for(bits);
+        bits = words_for(bits);
+    }
+    const size_t bitmap_bytes = bitmap_words * sizeof(uint64_t);
+    const size_t bitmap_frames = (bitmap_bytes + BYTES_PER_FRAME - 1) / BYTES_PER_FRAME;
+
+    // ビットマップを置ける大きさの空き領域を探す
+    uintptr_t bitmap_base = 0;
+    for_each_available(memory_map, [&](const MemoryDescriptor& desc)
+    {
+        if (bitmap_base == 0 && desc.physical_start >= LOW_MEMORY_END &&
+            desc.number_of_pages * UEFI_PAGE_SIZE >= bitmap_frames * BYTES_PER_FRAME)
+        {
+            bitmap_base = desc.physical_start;
+        }
+    });
+    if (bitmap_base == 0)
+    {
+        return MAKE_ERROR(Error::kNoEnoughMemory);
+    }
+
+    // 最初はすべて使用中とし，使える領域だけを空きにする
+    auto p = reinterpret_cast<uint64_t*>(bitmap_base);
+    memset(p, 0, bitmap_bytes);
+    for (int level = 0; level < LEVELS; ++level)
+    {
+        levels[level] = p;
+        p += words_for(level_bits[level]);
+    }
+    total_frames_ = 0;
+    free_frames_ = 0;
+
+    for_each_available(memory_map, [&](const MemoryDescriptor& desc)
+    {
+        uintptr_t start = desc.physical_start;
+        const uintptr_t end = desc.physical_start + desc.number_of_pages * UEFI_PAGE_SIZE;
+        if (start < LOW_MEMORY_END)
+        {
+            start = LOW_MEMORY_END;
+        }
+        if (start < end)
+        {
+            const size_t frames = (end - start) / BYTES_PER_FRAME;
+            set_range(start / BYTES_PER_FRAME, frames, true);
+            total_frames_ += frames;
+        }
+    });
+    mark_allocated(FrameID{bitmap_base / BYTES_PER_FRAME}, bitmap_frames);
+
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+WithError<FrameID> FrameManager::allocate(const size_t num_frames, const size_t align_frames)
+{
+    size_t start = 0;
+    while (true)
+    {
+        start = find_next_set(0, start);
+        if (start == NONE)
+        {
+            break;
+        }
+        start = (start + align_frames - 1) & ~(align_frames - 1);
+        if (start + num_frames > this->num_frames)
+        {
+            break;
+        }
+
+        const size_t used = find_used(start, start + num_frames);
+        if (used == start + num_frames)
+        {
+            set_range(start, num_frames, false);
+            return {FrameID{start}, MAKE_ERROR(Error::kSuccess)};
+        }
+        // 途中の使用中フレームより前からは取れないので，その次から探し直す
+        start = used + 1;
+    }
+    return {FrameID{NONE}, MAKE_ERROR(Error::kNoEnoughMemory)};
+}
+
+Error FrameManager::free(const FrameID start, const size_t num_frames)
+{
+    if (start.id() + num_frames > this->num_frames)
+    {
+        return MAKE_ERROR(Error::kIndexOutOfRange);
+    }
+    set_range(start.id(), num_frames, true);
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+void FrameManager::mark_allocated(const FrameID start, size_t num_frames)
+{
+    if (start.id() >= this->num_frames)
+    {
+        return;
+    }
+    if (start.id() + num_frames > this->num_frames)
+    {
+        num_frames = this->num_frames - start.id();
+    }
+    set_range(start.id(), num_frames, false);
+}
+
+size_t FrameManager::find_next_set(const int level, const size_t index) const
+{
+    if (index >= level_bits[level])
+    {
+        return NONE;
+    }
+    const uint64_t* bits = levels[level];
+    size_t w = index / 64;
+    if (const uint64_t word = bits[w] & ~0ull << index % 64)
+    {
+        return w * 64 + __builtin_ctzll(word);
+    }
+
+    if (level == LEVELS - 1)
+    {
+        // 最上段は十分小さいので順に見る
+        for (++w; w < words_for(level_bits[level]); ++w)
+        {
+            if (bits[w])
+            {
+                return w * 64 + __builtin_ctzll(bits[w]);
+            }
+        }
+        return NONE;
+    }
+
+    // 上の段で，0でない次の語を探す
+    w = find_next_set(level + 1, w + 1);
+    if (w == NONE)
+    {
+        return NONE;
+    }
+    return w * 64 + __builtin_ctzll(bits[w]);
+}
+
+size_t FrameManager::find_used(const size_t start, const size_t end) const
+{
+    const uint64_t* bits = levels[0];
+    for (size_t w = start / 64; w * 64 < end; ++w)
+    {
+        uint64_t used = ~bits[w];
+        if (w == start / 64)
+        {
+            used &= ~0ull << start % 64;
+        }
+        if (used)
+        {
+            const size_t frame = w * 64 + __builtin_ctzll(used);
+            return frame < end ? frame : end;
+        }
+    }
+    return end;
+}
+
+void FrameManager::set_range(const size_t start, const size_t num_frames, const bool free)
+{
+    if (num_frames == 0)
+    {
+        return;
+    }
+    uint64_t* bits = levels[0];
+    const size_t end = start + num_frames;
+    const size_t first = start / 64, last = (end - 1) / 64;
+    size_t changed = 0;
+    for (size_t w = first; w <= last; ++w)
+    {
+        uint64_t mask = ~0ull;
+        if (w == first)
+        {
+            mask &= ~0ull << start % 64;
+        }
+        if (w == last && end % 64 != 0)
+        {
+            mask &= ~0ull >> (64 - end % 64);
+        }
+        if (free)
+        {
+            changed += __builtin_popcountll(~bits[w] & mask);
+            bits[w] |= mask;
+        }
+        else
+        {
+            changed += __builtin_popcountll(bits[w] & mask);
+            bits[w] &= ~mask;
+        }
+    }
+    if (free)
+    {
+        free_frames_ += changed;
+    }
+    else
+    {
+        free_frames_ -= changed;
+    }
+    update_summary(first, last);
+}
+
+void FrameManager::update_summary(size_t first, size_t last)
+{
+    for (int level = 1; level < LEVELS; ++level)
+    {
+        const uint64_t* lower = levels[level - 1];
+        uint64_t* bits = levels[level];
+        for (size_t i = first; i <= last; ++i)
+        {
+            if (lower[i])
+            {
+                bits[i / 64] |= 1ull << i % 64;
+            }
+            else
+            {
+                bits[i / 64] &= ~(1ull << i % 64);
+            }
+        }
+        first /= 64;
+        last /= 64;
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef FRAME_MANAGER_HPP
+#define FRAME_MANAGER_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+#include "memory_map.hpp"
+
+/**
+ * @file frame_manager.hpp
+ *
+ * 物理メモリを4KiBのフレーム単位で管理する．
+ */
+
+constexpr size_t BYTES_PER_FRAME = 4096;
+
+class FrameID
+{
+public:
+    explicit FrameID(const size_t id) : id_{id}
+    {
+    }
+
+    [[nodiscard]] size_t id() const
+    {
+        return id_;
+    }
+
+    [[nodiscard]] void* frame() const
+    {
+        return reinterpret_cast<void*>(id_ * BYTES_PER_FRAME);
+    }
+
+private:
+    size_t id_;
+};
+
+/**
+ * フレームの空きをビットマップで管理する．
+ *
+ * ビットマップはフレーム毎に1ビット（1が空き）で，その上に「64ビットの語に空きが1つでもあるか」を
+ * 1ビットで表す要約を2段重ねる．空きを探すときは要約の0の語を飛ばせるので，
+ * 使用済みの領域がどれだけ続いていても数回の語の読み出しで次の空きに辿り着く．
+ * ビットマップ自体は起動時にメモリマップの空き領域の1つに置くので，
+ * 搭載メモリが数十GiBあっても静的な領域は要らない（64GiBでビットマップ約2MiB）．
+ */
+class FrameManager
+{
+public:
+    // UEFI のメモリマップのうち is_available() な領域を空きとして取り込む
+    // 記述子の配列（memory_map.buffer）は空きにする領域の外に置いておくこと
+    Error initialize(const MemoryMap& memory_map);
+
+    // 連続した num_frames 個のフレームを確保する．先頭のフレーム番号は align_frames（2の冪）の倍数になる
+    WithError<FrameID> allocate(size_t num_frames, size_t align_frames = 1);
+    Error free(FrameID start, size_t num_frames);
+    // 既に使われている領域を確保済みにする
+    void mark_allocated(FrameID start, size_t num_frames);
+
+    // メモリマップで使えるとされたフレームの数
+    [[nodiscard]] size_t total_frames() const
+    {
+        return total_frames_;
+    }
+
+    [[nodiscard]] size_t free_frames() const
+    {
+        return free_frames_;
+    }
+
+    void* operator new(size_t size, void* buf)
+    {
+        return buf;
+    }
+
+    void operator delete(void* obj) noexcept
+    {
+    }
+
+private:
+    static constexpr int LEVELS = 3;
+    static constexpr size_t NONE = ~static_cast<size_t>(0);
+
+    // 段 level で index 番目以降の最初の立っているビットの番号．なければ NONE
+    [[nodiscard]] size_t find_next_set(int level, size_t index) const;
+    // [start, end) の中で最初の使用中のフレームの番号．すべて空きなら end
+    [[nodiscard]] size_t find_used(size_t start, size_t end) const;
+    void set_range(size_t start, size_t num_frames, bool free);
+    // 段0の語 [first, last] の変化を上の段へ伝える
+    void update_summary(size_t first, size_t last);
+
+    // levels[0] がフレーム毎のビット，levels[k] のビットは levels[k-1] の語が0でないことを表す
+    std::array<uint64_t*, LEVELS> levels{};
+    std::array<size_t, LEVELS> level_bits{};
+    size_t num_frames = 0;
+    size_t total_frames_ = 0;
+    size_t free_frames_ = 0;
+};
+
+extern FrameManager* frame_manager;
+
+#endif //FRAME_MANAGER_HPP
@@ -1,43 +1,179 @@
 #include "graphics.hpp"
 
-void RGBResv8BitPerColorPixelWriter::write(const int x, const int y, const PixelColor& color)
+#include <cstring>
+#include <new>
+
+bool PixelWriter::clip_span(int& x, const int y, int& width, int& skipped) const
 {
-    const auto p = pixel_at(x, y);
-    p[0] = color.r;
-    p[1] = color.g;
-    p[2] = color.b;
+    skipped = 0;
+    if (y < 0 || y >= height())
+    {
+        return false;
+    }
+    if (x < 0)
+    {
+        skipped = -x;
+        width += x;
+        x = 0;
+    }
+    if (x + width > this->width())
+    {
+        width = this->width() - x;
+    }
+    return width > 0;
 }
 
-void BGRResv8BitPerColorPixelWriter::write(const int x, const int y, const PixelColor& color)
+void PixelWriter::fill_span(int x, const int y, int width, const uint32_t pixel)
 {
-    const auto p = pixel_at(x, y);
-    p[0] = color.b;
-    p[1] = color.g;
-    p[2] = color.r;
+    int skipped;
+    if (!clip_span(x, y, width, skipped))
+    {
+        return;
+    }
+
+    fill_words(pixel_word_at(x, y), width, pixel);
 }
 
-void fill_rectangle(PixelWriter& writer, const Vector2D<int>& pos, const Vector2D<int>& size, const PixelColor& color)
+void PixelWriter::fill_rect(const Vector2D<int>& pos, const Vector2D<int>& size, const uint32_t pixel)
 {
     for (int dy = 0; dy < size.y; ++dy)
     {
-        for (int dx = 0; dx < size.x; ++dx)
+        fill_span(pos.x, pos.y + dy, size.x, pixel);
+    }
+}
+
+void PixelWriter::write_row(int x, const int y, const uint32_t* pixels, int width)
+{
+    int skipped;
+    if (!clip_span(x, y, width, skipped))
+    {
+        return;
+    }
+    memcpy(pixel_word_at(x, y), pixels + skipped, 4 * width);
+}
+
+void PixelWriter::move_rect(const Vector2D<int>& dst_pos, const Rectangle<int>& src)
+{
+    const Rectangle<int> screen{{0, 0}, {width(), height()}};
+    const Vector2D<int> offset{dst_pos.x - src.pos.x, dst_pos.y - src.pos.y};
+    // 移動元と移動先の両方が画面内に収まる部分だけを移す
+    auto area = src & screen;
+    area = area & Rectangle<int>{{screen.pos.x - offset.x, screen.pos.y - offset.y}, screen.size};
+    if (area.empty())
+    {
+        return;
+    }
+
+    const auto bytes_per_row = 4 * area.size.x;
+    if (offset.y <= 0)
+    {
+        // 上へ移すときは上の行から順に移せば，まだ移していない行を上書きしない
+        for (int y = area.pos.y; y < area.bottom(); ++y)
         {
-            writer.write(pos.x + dx, pos.y + dy, color);
+            memmove(pixel_word_at(area.pos.x + offset.x, y + offset.y), pixel_word_at(area.pos.x, y), bytes_per_row);
+        }
+    }
+    else
+    {
+        for (int y = area.bottom() - 1; y >= area.pos.y; --y)
+        {
+            memmove(pixel_word_at(area.pos.x + offset.x, y + offset.y), pixel_word_at(area.pos.x, y), bytes_per_row);
         }
     }
 }
 
-void draw_rectangle(PixelWriter& writer, const Vector2D<int>& pos, const Vector2D<int>& size, const PixelColor& color)
+void PixelWriter::read_row(int x, const int y, uint32_t* pixels, int width) const
 {
-    for (int dx = 0; dx < size.x; ++dx)
+    int skipped;
+    if (!clip_span(x, y, width, skipped))
     {
-        writer.write(pos.x + dx, pos.y, color);
-        writer.write(pos.x + dx, pos.y + size.y - 1, color);
+        return;
     }
-    for (int dy = 1; dy < size.y - 1; ++dy)
+    memcpy(pixels + skipped, pixel_word_at(x, y), 4 * width);
+}
+
+void PixelWriter::write_bitmap(const int x, const int y, const uint8_t* rows, const int width, const int height,
+                               const uint32_t pixel)
+{
+    for (int dy = 0; dy < height; ++dy)
     {
-        writer.write(pos.x, pos.y + dy, color);
-        writer.write(pos.x + size.x - 1, pos.y + dy, color);
+        int left = x;
+        int w = width;
+        int skipped;
+        if (!clip_span(left, y + dy, w, skipped))
+        {
+            continue;
+        }
+        fill_bits(pixel_word_at(left, y + dy), rows[dy], skipped, w, pixel);
     }
 }
 
+BitMaskPixelWriter::BitMaskPixelWriter(const FrameBufferConfig& config)
+    : PixelWriter(config),
+      red{make_channel(config.pixel_bitmask.red_mask)},
+      green{make_channel(config.pixel_bitmask.green_mask)},
+      blue{make_channel(config.pixel_bitmask.blue_mask)}
+{
+}
+
+BitMaskPixelWriter::Channel BitMaskPixelWriter::make_channel(const uint32_t mask)
+{
+    if (mask == 0)
+    {
+        return {0, 0, 0};
+    }
+    return {mask, __builtin_ctz(mask), __builtin_popcount(mask)};
+}
+
+uint32_t BitMaskPixelWriter::convert(const uint8_t value, const Channel& channel)
+{
+    // 8ビットの値をマスクのビット数に合わせて拡大・縮小する
+    uint32_t v = value;
+    if (channel.bits < 8)
+    {
+        v >>= 8 - channel.bits;
+    }
+    else
+    {
+        v <<= channel.bits - 8;
+    }
+    return v << channel.shift & channel.mask;
+}
+
+void BitMaskPixelWriter::write(const int x, const int y, const PixelColor& color)
+{
+    *pixel_word_at(x, y) = to_pixel(color);
+}
+
+uint32_t BitMaskPixelWriter::to_pixel(const PixelColor& color) const
+{
+    return convert(color.r, red) | convert(color.g, green) | convert(color.b, blue);
+}
+
+PixelWriter* new_pixel_writer(void* buf, const FrameBufferConfig& config)
+{
+    switch (config.pixel_format)
+    {
+    case kPixelRGBResv8BitPerColor:
+        return new(buf) RGBResv8BitPerColorPixelWriter{config};
+    case kPixelBGRResv8BitPerColor:
+        return new(buf) BGRResv8BitPerColorPixelWriter{config};
+    case kPixelBitMask:
+        return new(buf) BitMaskPixelWriter{config};
+    }
+    return nullptr;
+}
+
+void fill_rectangle(PixelWriter& writer, const Vector2D<int>& pos, const Vector2D<int>& size, const PixelColor& color)
+{
+    writer.fill_rect(pos, size, writer.to_pixel(color));
+}
+
+void draw_rectangle(PixelWriter& writer, const Vector2D<int>& pos, const Vector2D<int>& size, const PixelColor& color)
+{
+    const uint32_t pixel = writer.to_pixel(color);
+    writer.fill_span(pos.x, pos.y, size.x, pixel);
+    writer.fill_span(pos.x, pos.y + size.y - 1, size.x, pixel);
+    writer.fill_rect({pos.x, pos.y + 1}, {1, size.y - 2}, pixel);
+    writer.fill_rect({pos.x + size.x - 1, pos.y + 1}, {1, size.y - 2}, pixel);
+}
@@ -11,6 +11,87 @@ struct PixelColor
     uint8_t r, g, b;
 };
 
+template <typename T>
+struct Vector2D
+{
+    T x, y;
+
+    template <typename U>
+    Vector2D& operator +=(const Vector2D<U>& rhs)
+    {
+        x += rhs.x;
+        y += rhs.y;
+        return *this;
+    }
+};
+
+template <typename T, typename U>
+auto operator +(const Vector2D<T>& lhs, const Vector2D<U>& rhs) -> Vector2D<decltype(lhs.x + rhs.x)>
+{
+    return {lhs.x + rhs.x, lhs.y + rhs.y};
+}
+
+template <typename T>
+struct Rectangle
+{
+    Vector2D<T> pos, size;
+
+    [[nodiscard]] bool empty() const
+    {
+        return size.x <= 0 || size.y <= 0;
+    }
+
+    [[nodiscard]] T right() const
+    {
+        return pos.x + size.x;
+    }
+
+    [[nodiscard]] T bottom() const
+    {
+        return pos.y + size.y;
+    }
+
+    [[nodiscard]] bool contains(const Rectangle& other) const
+    {
+        return pos.x <= other.pos.x && pos.y <= other.pos.y &&
+            other.right() <= right() && other.bottom() <= bottom();
+    }
+};
+
+// 2つの矩形の共通部分．重ならなければ空の矩形を返す
+template <typename T>
+Rectangle<T> operator &(const Rectangle<T>& lhs, const Rectangle<T>& rhs)
+{
+    const T left = lhs.pos.x > rhs.pos.x ? lhs.pos.x : rhs.pos.x;
+    const T top = lhs.pos.y > rhs.pos.y ? lhs.pos.y : rhs.pos.y;
+    const T right = lhs.right() < rhs.right() ? lhs.right() : rhs.right();
+    const T bottom = lhs.bottom() < rhs.bottom() ? lhs.bottom() : rhs.bottom();
+    if (right <= left || bottom <= top)
+    {
+        return {{left, top}, {0, 0}};
+    }
+    return {{left, top}, {right - left, bottom - top}};
+}
+
+// 2つの矩形を両方含む最小の矩形
+template <typename T>
+Rectangle<T> operator |(const Rectangle<T>& lhs, const Rectangle<T>& rhs)
+{
+    const T left = lhs.pos.x < rhs.pos.x ? lhs.pos.x : rhs.pos.x;
+    const T top = lhs.pos.y < rhs.pos.y ? lhs.pos.y : rhs.pos.y;
+    const T right = lhs.right() > rhs.right() ? lhs.right() : rhs.right();
+    const T bottom = lhs.bottom() > rhs.bottom() ? lhs.bottom() : rhs.bottom();
+    return {{left, top}, {right - left, bottom - top}};
+}
+
+/**
+ * フレームバッファへの描画を抽象化する．
+ *
+ * 1ピクセルずつの write() に加えて，水平方向の連続領域（スパン）や矩形をまとめて描く
+ * プリミティブを持つ．RGB/BGRどちらの形式も1ピクセル4バイトなので，色を一度 to_pixel() で
+ * 32ビット値に変換してしまえば，以降は形式に依らずワード単位の連続ストアで描ける．
+ * 仮想関数呼び出しはピクセル毎ではなくプリミティブ毎に1回で済む．
+ */
 class PixelWriter
 {
 public:
@@ -21,22 +102,163 @@ public:
     virtual ~PixelWriter() = default;
     virtual void write(int x, int y, const PixelColor& color) = 0;
 
+    // 色をフレームバッファ上の32ビットのピクセル値に変換する
+    [[nodiscard]] virtual uint32_t to_pixel(const PixelColor& color) const = 0;
+
+    // (x, y)から右方向にwidthピクセルをpixelで塗る
+    virtual void fill_span(int x, int y, int width, uint32_t pixel);
+    // posを左上とするsizeの矩形をpixelで塗る
+    virtual void fill_rect(const Vector2D<int>& pos, const Vector2D<int>& size, uint32_t pixel);
+    // 変換済みのピクセル列pixels[0..width)を(x, y)から右方向にコピーする
+    virtual void write_row(int x, int y, const uint32_t* pixels, int width);
+    // 矩形srcの内容をdst_posを左上とする位置へ移す．移動元と移動先は重なっていてもよい
+    virtual void move_rect(const Vector2D<int>& dst_pos, const Rectangle<int>& src);
+    // (x, y)から右方向にwidthピクセルを読み出してpixels[0..width)に格納する
+    virtual void read_row(int x, int y, uint32_t* pixels, int width) const;
+    // 1行1バイトのビットマップ（最上位ビットが左端）の立っているビットをpixelで塗る
+    virtual void write_bitmap(int x, int y, const uint8_t* rows, int width, int height, uint32_t pixel);
+
+    void write_span(const int x, const int y, const int width, const PixelColor& color)
+    {
+        fill_span(x, y, width, to_pixel(color));
+    }
+
+    [[nodiscard]] int width() const
+    {
+        return static_cast<int>(config.horizontal_resolution);
+    }
+
+    [[nodiscard]] int height() const
+    {
+        return static_cast<int>(config.vertical_resolution);
+    }
+
 protected:
     [[nodiscard]] uint8_t* pixel_at(const int x, const int y) const
     {
         return config.frame_buffer + 4 * (config.pixels_per_scan_line * y + x);
     }
 
+    [[nodiscard]] uint32_t* pixel_word_at(const int x, const int y) const
+    {
+        return reinterpret_cast<uint32_t*>(pixel_at(x, y));
+    }
+
+    // スパンを画面内に切り詰める．描く部分が残らなければfalseを返す
+    // skippedには左端で切り捨てたピクセル数を返す
+    bool clip_span(int& x, int y, int& width, int& skipped) const;
+
+    // 矩形を画面内に切り詰める
+    [[nodiscard]] Rectangle<int> clip_rect(const Vector2D<int>& pos, const Vector2D<int>& size) const
+    {
+        return Rectangle<int>{pos, size} & Rectangle<int>{{0, 0}, {width(), height()}};
+    }
+
+    // p[0..count)をpixelで塗る
+    // 4バイト単位の単純なループにしておくとコンパイラがベクトル命令でまとめて書き込む
+    static void fill_words(uint32_t* __restrict p, const int count, const uint32_t pixel)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            p[i] = pixel;
+        }
+    }
+
+    // ビットマップの1行rowのうち，左からskippedビットを除いたcountビットの立っている位置をpixelで塗る
+    static void fill_bits(uint32_t* p, const uint8_t row, const int skipped, const int count, const uint32_t pixel)
+    {
+        const unsigned int bits = static_cast<unsigned int>(row) << skipped;
+        for (int i = 0; i < count; ++i)
+        {
+            if (bits << i & 0x80u)
+            {
+                p[i] = pixel;
+            }
+        }
+    }
+
 private:
     const FrameBufferConfig& config;
 };
 
-class RGBResv8BitPerColorPixelWriter final : public PixelWriter
+/**
+ * ピクセル形式毎の特性．色から32ビットのピクセル値への変換をコンパイル時に決める．
+ */
+struct RGBResv8BitPerColor
+{
+    static constexpr uint32_t to_pixel(const PixelColor& color)
+    {
+        return color.r | static_cast<uint32_t>(color.g) << 8 | static_cast<uint32_t>(color.b) << 16;
+    }
+};
+
+struct BGRResv8BitPerColor
+{
+    static constexpr uint32_t to_pixel(const PixelColor& color)
+    {
+        return color.b | static_cast<uint32_t>(color.g) << 8 | static_cast<uint32_t>(color.r) << 16;
+    }
+};
+
+/**
+ * ピクセル形式 Format に特化した PixelWriter．
+ * 形式の選択は生成時の1回だけで，塗りつぶしと文字のプリミティブは Format 毎に実体化される．
+ * final なので，矩形やビットマップの行毎の処理は仮想呼び出しを経ずにインライン展開され，
+ * 画面内への切り詰めもプリミティブ毎に1回で済む．
+ * write_row()，move_rect()，read_row() は変換済みのピクセルをコピーするだけで形式に依らないので，
+ * PixelWriter のものを使う．
+ */
+template <typename Format>
+class BasicPixelWriter final : public PixelWriter
 {
 public:
     using PixelWriter::PixelWriter;
 
-    void write(int x, int y, const PixelColor& color) override;
+    void write(const int x, const int y, const PixelColor& color) override
+    {
+        *pixel_word_at(x, y) = Format::to_pixel(color);
+    }
+
+    [[nodiscard]] uint32_t to_pixel(const PixelColor& color) const override
+    {
+        return Format::to_pixel(color);
+    }
+
+    void fill_span(int x, const int y, int width, const uint32_t pixel) override
+    {
+        int skipped;
+        if (clip_span(x, y, width, skipped))
+        {
+            fill_words(pixel_word_at(x, y), width, pixel);
+        }
+    }
+
+    void fill_rect(const Vector2D<int>& pos, const Vector2D<int>& size, const uint32_t pixel) override
+    {
+        const auto area = clip_rect(pos, size);
+        if (area.empty())
+        {
+            return;
+        }
+        for (int y = area.pos.y; y < area.bottom(); ++y)
+        {
+            fill_words(pixel_word_at(area.pos.x, y), area.size.x, pixel);
+        }
+    }
+
+    void write_bitmap(const int x, const int y, const uint8_t* rows, const int width, const int height,
+                      const uint32_t pixel) override
+    {
+        const auto area = clip_rect({x, y}, {width, height});
+        if (area.empty())
+        {
+            return;
+        }
+        for (int dy = area.pos.y - y; dy < area.bottom() - y; ++dy)
+        {
+            fill_bits(pixel_word_at(area.pos.x, y + dy), rows[dy], area.pos.x - x, area.size.x, pixel);
+        }
+    }
 
     void* operator new(size_t size, void* buf)
     {
@@ -48,13 +270,20 @@ public:
     }
 };
 
+using RGBResv8BitPerColorPixelWriter = BasicPixelWriter<RGBResv8BitPerColor>;
+using BGRResv8BitPerColorPixelWriter = BasicPixelWriter<BGRResv8BitPerColor>;
 
-class BGRResv8BitPerColorPixelWriter final : public PixelWriter
+/**
+ * GOPの PixelBitMask 形式用の PixelWriter．各色の位置と幅は起動時にマスクから求める．
+ * 変換はプリミティブ毎に1回なので，よく使われる形式の描画を遅くすることはない．
+ */
+class BitMaskPixelWriter final : public PixelWriter
 {
 public:
-    using PixelWriter::PixelWriter;
+    explicit BitMaskPixelWriter(const FrameBufferConfig& config);
 
     void write(int x, int y, const PixelColor& color) override;
+    [[nodiscard]] uint32_t to_pixel(const PixelColor& color) const override;
 
     void* operator new(size_t size, void* buf)
     {
@@ -64,22 +293,30 @@ public:
     void operator delete(void* obj) noexcept
     {
     }
-};
-
-template <typename T>
-struct Vector2D
-{
-    T x, y;
 
-    template <typename U>
-    Vector2D& operator +=(const Vector2D<U>& rhs)
+private:
+    struct Channel
     {
-        x += rhs.x;
-        y += rhs.y;
-        return *this;
-    }
+        uint32_t mask;
+        int shift; // マスクの最下位ビットの位置
+        int bits; // マスクのビット数
+    };
+
+    static Channel make_channel(uint32_t mask);
+    static uint32_t convert(uint8_t value, const Channel& channel);
+
+    Channel red, green, blue;
 };
 
+// どのピクセル形式の PixelWriter でも入るバッファの大きさ
+constexpr size_t PIXEL_WRITER_BUF_SIZE =
+    sizeof(RGBResv8BitPerColorPixelWriter) > sizeof(BitMaskPixelWriter)
+        ? sizeof(RGBResv8BitPerColorPixelWriter)
+        : sizeof(BitMaskPixelWriter);
+
+// config のピクセル形式に合わせた PixelWriter を buf 上に生成する
+PixelWriter* new_pixel_writer(void* buf, const FrameBufferConfig& config);
+
 void fill_rectangle(PixelWriter& writer, const Vector2D<int>& pos, const Vector2D<int>& size, const PixelColor& color);
 void draw_rectangle(PixelWriter& writer, const Vector2D<int>& pos, const Vector2D<int>& size, const PixelColor& color);
 
@@ -0,0 +1,306 @@
+#include "heap.hpp"
+
+#include <array>
+#include <cerrno>
+#include <new>
+
+#include "interrupt.hpp"
+
+// newlib_support.c の sbrk が切り出す領域
+extern "C" char *program_break, *program_break_end;
+
+namespace
+{
+    FrameManager* frame_source;
+
+    // 2の冪の大きさ毎のキャッシュ．これより大きいものはフレーム単位で確保する
+    std::array<SlabCache, 7> caches{
+        SlabCache{16}, SlabCache{32}, SlabCache{64}, SlabCache{128},
+        SlabCache{256}, SlabCache{512}, SlabCache{1024},
+    };
+    constexpr size_t MAX_SLAB_OBJECT_SIZE = 1024;
+
+    /**
+     * フレーム単位で確保した領域のヘッダ．返すアドレスの直前のフレームの先頭に置く．
+     */
+    struct LargeHeader
+    {
+        // スラブと区別するため常に nullptr
+        SlabCache* cache;
+        size_t first_frame;
+        size_t num_frames;
+    };
+
+    size_t large_allocations = 0;
+    size_t large_frames = 0;
+    LatencyStats large_latency;
+
+    // オブジェクトの直前にあるフレーム境界．スラブでもフレーム単位の領域でも，そこにヘッダがある
+    void* page_header(void* pointer)
+    {
+        return reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(pointer) - 1) & ~(BYTES_PER_FRAME - 1));
+    }
+
+    SlabCache* cache_for(const size_t size)
+    {
+        for (auto& cache : caches)
+        {
+            if (size <= cache.object_size())
+            {
+                return &cache;
+            }
+        }
+        return nullptr;
+    }
+
+    void* allocate_large(const size_t size, const size_t alignment)
+    {
+        ScopedTimer timer{large_latency};
+        // ヘッダの分として，返すアドレスの前に整列単位（最低1フレーム）を余分に取る
+        const size_t align_frames = alignment > BYTES_PER_FRAME ? alignment / BYTES_PER_FRAME : 1;
+        const size_t num_frames = (size + BYTES_PER_FRAME - 1) / BYTES_PER_FRAME + align_frames;
+        const auto frames = frame_source->allocate(num_frames, align_frames);
+        if (frames.error)
+        {
+            return nullptr;
+        }
+
+        const auto start = reinterpret_cast<uintptr_t>(frames.value.frame());
+        const auto object = reinterpret_cast<void*>(start + align_frames * BYTES_PER_FRAME);
+        const auto header = static_cast<LargeHeader*>(page_header(object));
+        header->cache = nullptr;
+        header->first_frame = frames.value.id();
+        header->num_frames = num_frames;
+        ++large_allocations;
+        large_frames += num_frames;
+        return object;
+    }
+
+    void free_large(const LargeHeader* header)
+    {
+        --large_allocations;
+        large_frames -= header->num_frames;
+        frame_source->free(FrameID{header->first_frame}, header->num_frames);
+    }
+}
+
+void* SlabCache::allocate()
+{
+    ScopedTimer timer{latency_};
+    if (partial == nullptr)
+    {
+        const auto frame = frame_source->allocate(1);
+        if (frame.error)
+        {
+            return nullptr;
+        }
+        const auto page = static_cast<uint8_t*>(frame.value.frame());
+        const auto slab = reinterpret_cast<SlabHeader*>(page);
+        slab->cache = this;
+        slab->objects_in_use = 0;
+        slab->free_list = nullptr;
+        // 先頭のオブジェクトから順に取り出されるよう，後ろから積む
+        for (size_t i = objects_per_slab; i > 0; --i)
+        {
+            const auto object = reinterpret_cast<FreeObject*>(page + first_offset + (i - 1) * object_size_);
+            object->next = slab->free_list;
+            slab->free_list = object;
+        }
+        push_partial(slab);
+        ++num_slabs_;
+    }
+
+    SlabHeader* slab = partial;
+    FreeObject* object = slab->free_list;
+    slab->free_list = object->next;
+    ++slab->objects_in_use;
+    ++objects_in_use_;
+    if (slab->free_list == nullptr)
+    {
+        remove_partial(slab);
+    }
+    return object;
+}
+
+void SlabCache::free(void* object)
+{
+    const auto slab = static_cast<SlabHeader*>(page_header(object));
+    if (slab->free_list == nullptr)
+    {
+        // 満杯だったスラブに空きができた
+        push_partial(slab);
+    }
+    const auto free_object = static_cast<FreeObject*>(object);
+    free_object->next = slab->free_list;
+    slab->free_list = free_object;
+    --slab->objects_in_use;
+    --objects_in_use_;
+
+    // 空になったスラブは，他に空きのあるスラブがあればフレームごと返す
+    if (slab->objects_in_use == 0 && (slab->prev || slab->next))
+    {
+        remove_partial(slab);
+        --num_slabs_;
+        frame_source->free(FrameID{reinterpret_cast<uintptr_t>(slab) / BYTES_PER_FRAME}, 1);
+    }
+}
+
+void SlabCache::push_partial(SlabHeader* slab)
+{
+    slab->prev = nullptr;
+    slab->next = partial;
+    if (partial)
+    {
+        partial->prev = slab;
+    }
+    partial = slab;
+}
+
+void SlabCache::remove_partial(SlabHeader* slab)
+{
+    if (slab->prev)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        partial = slab->next;
+    }
+    if (slab->next)
+    {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = slab->prev = nullptr;
+}
+
+namespace heap
+{
+    Error initialize(FrameManager& frames, const size_t arena_frames)
+    {
+        frame_source = &frames;
+
+        const auto arena = frames.allocate(arena_frames);
+        if (arena.error)
+        {
+            return arena.error;
+        }
+        program_break = static_cast<char*>(arena.value.frame());
+        program_break_end = program_break + arena_frames * BYTES_PER_FRAME;
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    void* allocate(const size_t size, const size_t alignment)
+    {
+        // オブジェクトは自分の大きさで整列しているので，整列の要求は大きさの要求に置き換えられる
+        const size_t slab_size = size > alignment ? size : alignment;
+        // タスクの切り替えで他のタスクの確保と重ならないようにする
+        const auto rflags = save_and_disable_interrupts();
+        void* const pointer = slab_size <= MAX_SLAB_OBJECT_SIZE
+                                  ? cache_for(slab_size)->allocate()
+                                  : allocate_large(size, alignment);
+        restore_interrupts(rflags);
+        return pointer;
+    }
+
+    void free(void* pointer)
+    {
+        if (pointer == nullptr)
+        {
+            return;
+        }
+        const auto header = page_header(pointer);
+        const auto rflags = save_and_disable_interrupts();
+        if (const auto cache = *static_cast<SlabCache**>(header))
+        {
+            cache->free(pointer);
+        }
+        else
+        {
+            free_large(static_cast<LargeHeader*>(header));
+        }
+        restore_interrupts(rflags);
+    }
+
+    void report(const LogLevel level)
+    {
+        for (const auto& cache : caches)
+        {
+            const auto& latency = cache.latency();
+            log(level, "slab %4lu: %lu objects (%lu bytes) in %lu slabs, alloc avg %lu max %lu ns\n",
+                cache.object_size(), cache.objects_in_use(), cache.objects_in_use() * cache.object_size(),
+                cache.num_slabs(),
+                latency.count ? timing::to_nanoseconds(latency.total / latency.count) : 0,
+                timing::to_nanoseconds(latency.max));
+        }
+        log(level, "large: %lu allocations (%lu bytes), alloc avg %lu max %lu ns\n",
+            large_allocations, large_frames * BYTES_PER_FRAME,
+            large_latency.count ? timing::to_nanoseconds(large_latency.total / large_latency.count) : 0,
+            timing::to_nanoseconds(large_latency.max));
+    }
+}
+
+void* operator new(const size_t size)
+{
+    return heap::allocate(size);
+}
+
+void* operator new[](const size_t size)
+{
+    return heap::allocate(size);
+}
+
+void* operator new(const size_t size, const std::nothrow_t&) noexcept
+{
+    return heap::allocate(size);
+}
+
+void* operator new[](const size_t size, const std::nothrow_t&) noexcept
+{
+    return heap::allocate(size);
+}
+
+void* operator new(const size_t size, const std::align_val_t alignment)
+{
+    return heap::allocate(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](const size_t size, const std::align_val_t alignment)
+{
+    return heap::allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* pointer) noexcept
+{
+    heap::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    heap::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    heap::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+    heap::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+    heap::free(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept
+{
+    heap::free(pointer);
+}
+
+extern "C" int posix_memalign(void** pointer, const size_t alignment, const size_t size)
+{
+    *pointer = heap::allocate(size, alignment);
+    return *pointer ? 0 : ENOMEM;
+}
@@ -0,0 +1,103 @@
+#ifndef HEAP_HPP
+#define HEAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+#include "frame_manager.hpp"
+#include "logger.hpp"
+#include "timing.hpp"
+
+/**
+ * @file heap.hpp
+ *
+ * カーネルのヒープ．operator new / posix_memalign と，newlib の malloc が使う sbrk の領域を提供する．
+ */
+
+/**
+ * 同じ大きさのオブジェクトを1フレーム単位のスラブから切り出すキャッシュ．
+ *
+ * スラブの先頭に SlabHeader を置き，オブジェクト毎のヘッダは持たない．
+ * オブジェクトは自分の大きさ（2の冪）で整列している．
+ * 解放はオブジェクトのアドレスからスラブの先頭を求めて，そのスラブの空きリストへ戻すだけで済む．
+ */
+class SlabCache
+{
+public:
+    // グローバル変数として置けるよう，コンストラクタは定数式で評価できるようにしておく
+    // （カーネルはグローバル変数のコンストラクタを呼ばない）
+    explicit constexpr SlabCache(const size_t object_size)
+        : object_size_{object_size},
+          first_offset{(sizeof(SlabHeader) + object_size - 1) / object_size * object_size},
+          objects_per_slab{(BYTES_PER_FRAME - first_offset) / object_size}
+    {
+    }
+
+    void* allocate();
+    void free(void* object);
+
+    [[nodiscard]] size_t object_size() const
+    {
+        return object_size_;
+    }
+
+    [[nodiscard]] size_t objects_in_use() const
+    {
+        return objects_in_use_;
+    }
+
+    [[nodiscard]] size_t num_slabs() const
+    {
+        return num_slabs_;
+    }
+
+    [[nodiscard]] const LatencyStats& latency() const
+    {
+        return latency_;
+    }
+
+private:
+    struct FreeObject
+    {
+        FreeObject* next;
+    };
+
+    // スラブとして使うフレームの先頭に置く
+    struct SlabHeader
+    {
+        // 大きな領域のヘッダと区別するため，先頭は必ず所属するキャッシュを指す
+        SlabCache* cache;
+        FreeObject* free_list;
+        size_t objects_in_use;
+        SlabHeader* next;
+        SlabHeader* prev;
+    };
+
+    void push_partial(SlabHeader* slab);
+    void remove_partial(SlabHeader* slab);
+
+    size_t object_size_;
+    size_t first_offset;
+    size_t objects_per_slab;
+    // 空きのあるスラブのリスト
+    SlabHeader* partial = nullptr;
+    size_t num_slabs_ = 0;
+    size_t objects_in_use_ = 0;
+    LatencyStats latency_;
+};
+
+namespace heap
+{
+    // sbrk に渡す領域として arena_frames フレームを frames から確保する
+    Error initialize(FrameManager& frames, size_t arena_frames);
+
+    // alignment は2の冪．確保できなければ nullptr を返す
+    void* allocate(size_t size, size_t alignment = alignof(max_align_t));
+    void free(void* pointer);
+
+    // キャッシュ毎の使用量と確保にかかった時間をログに出す
+    void report(LogLevel level);
+}
+
+#endif //HEAP_HPP
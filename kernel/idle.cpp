@@ -0,0 +1,134 @@
+#include "idle.hpp"
+
+#include <cpuid.h>
+
+#include "cpu.hpp"
+#include "timing.hpp"
+
+namespace
+{
+    bool mwait_supported = false;
+    // MWAIT の拡張で，割り込みが禁止されていても割り込みで起きられる
+    bool mwait_breaks_on_interrupt = false;
+    // MWAIT の EAX に渡すヒント．ビット7:4 が C ステート - 1，ビット3:0 がサブステート
+    uint32_t mwait_hint = 0;
+
+    void monitor(const void* address)
+    {
+        __asm__ volatile("monitor" :: "a"(address), "c"(0), "d"(0) : "memory");
+    }
+
+    // 割り込みを禁止した状態で呼び，割り込みを許可して戻る．
+    // 拡張が使えれば ECX ビット0 を立て，割り込みを禁止したまま眠る．
+    // 使えなければ sti の直後の1命令は割り込まれないことを使い，sti; mwait で眠る
+    void mwait(const uint32_t hint)
+    {
+        if (mwait_breaks_on_interrupt)
+        {
+            __asm__ volatile("mwait\n\tsti" :: "a"(hint), "c"(1) : "memory");
+        }
+        else
+        {
+            __asm__ volatile("sti\n\tmwait" :: "a"(hint), "c"(0) : "memory");
+        }
+    }
+
+    // 割り込みを禁止した状態で呼ぶ
+    void sleep(const EventDispatcher& dispatcher)
+    {
+        if (mwait_supported)
+        {
+            // MONITOR の後の書き込みは MWAIT を即座に終わらせるので，確認と眠りの間に来た仕事を取りこぼさない
+            monitor(dispatcher.wake_address());
+            if (dispatcher.has_work())
+            {
+                __asm__ volatile("sti" ::: "memory");
+            }
+            else
+            {
+                mwait(mwait_hint);
+            }
+        }
+        else
+        {
+            // stiの次の命令の実行までは割り込まれないので，確認とhltの間に来た割り込みを取りこぼさない
+            if (dispatcher.has_work())
+            {
+                __asm__ volatile("sti" ::: "memory");
+            }
+            else
+            {
+                __asm__ volatile("sti\n\thlt" ::: "memory");
+            }
+        }
+    }
+}
+
+namespace idle
+{
+    void initialize(const int max_cstate)
+    {
+        unsigned int eax, ebx, ecx, edx;
+        __cpuid(1, eax, ebx, ecx, edx);
+        mwait_supported = ecx & (1u << 3);
+        if (mwait_supported && __get_cpuid_max(0, nullptr) >= 6)
+        {
+            // CPUID 6 EAX ビット2 (ARAT): どの C ステートでも Local APIC タイマーが止まらない
+            __cpuid(6, eax, ebx, ecx, edx);
+            const bool always_running_timer = eax & (1u << 2);
+            const int deepest = always_running_timer ? max_cstate : 1;
+
+            // CPUID 5 ECX ビット0: MWAIT の拡張を列挙している，ビット1: 割り込みを禁止していても割り込みで起きられる
+            // EDX には C ステート毎に使えるサブステートの数が4ビットずつ並んでいる
+            __cpuid(5, eax, ebx, ecx, edx);
+            mwait_breaks_on_interrupt = (ecx & 0x3u) == 0x3u;
+            for (int cstate = deepest; cstate >= 1; --cstate)
+            {
+                if ((edx >> 4 * cstate & 0xfu) != 0)
+                {
+                    mwait_hint = static_cast<uint32_t>(cstate - 1) << 4;
+                    break;
+                }
+            }
+        }
+        this_cpu().idle_reported_at = timing::now();
+
+        log(kInfo, "idle: %s, hint %02x\n", mwait_supported ? "mwait" : "hlt", mwait_hint);
+    }
+
+    bool uses_mwait()
+    {
+        return mwait_supported;
+    }
+
+    void wait_for_work(const EventDispatcher& dispatcher)
+    {
+        __asm__ volatile("cli" ::: "memory");
+        if (dispatcher.has_work())
+        {
+            __asm__ volatile("sti" ::: "memory");
+            return;
+        }
+
+        const uint64_t start = timing::now();
+        sleep(dispatcher);
+        this_cpu().idle_counts.fetch_add(timing::now() - start, std::memory_order_relaxed);
+    }
+
+    void report(const LogLevel level)
+    {
+        for (int i = 0; i < cpu::count(); ++i)
+        {
+            auto& cpu = cpu::at(i);
+            const uint64_t now = timing::now();
+            const uint64_t idle = cpu.idle_counts.exchange(0, std::memory_order_relaxed);
+            const uint64_t total = now - cpu.idle_reported_at;
+            const uint64_t busy = total > idle ? total - idle : 0;
+            log(level, "idle cpu %d: %lu ms, busy: %lu ms (%lu%% busy)\n",
+                i, timing::to_nanoseconds(idle) / 1'000'000,
+                timing::to_nanoseconds(busy) / 1'000'000,
+                total ? busy * 100 / total : 0);
+            cpu.idle_reported_at = now;
+        }
+    }
+}
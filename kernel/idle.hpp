@@ -0,0 +1,37 @@
+#ifndef IDLE_HPP
+#define IDLE_HPP
+
+#include <cstdint>
+
+#include "event.hpp"
+#include "logger.hpp"
+
+/**
+ * @file idle.hpp
+ *
+ * メインループに仕事がない間 CPU を休ませる．
+ *
+ * MONITOR/MWAIT が使えれば EventDispatcher::wake_address() のキャッシュラインを見張って眠る．
+ * 他のコアがメッセージを投函するとその書き込みだけで起き，割り込みを経由しない．
+ * 使えなければ hlt で次の割り込みを待つ．
+ *
+ * initialize() は BSP で1回呼べばよい．AP も同じヒントで眠る．
+ */
+
+namespace idle
+{
+    // max_cstate は MWAIT で入ってよい最も深い C ステート（1 なら C1）．
+    // Local APIC タイマーが止まる C ステートは，ARAT がなければ選ばない
+    void initialize(int max_cstate);
+
+    [[nodiscard]] bool uses_mwait();
+
+    // dispatcher に仕事が来るか割り込みがあるまで眠る．割り込みを許可した状態で呼ぶ
+    // 眠っていた時間は呼んだコアの CPU に記録する
+    void wait_for_work(const EventDispatcher& dispatcher);
+
+    // 前回の報告からの，眠っていた時間と動いていた時間をコア毎にログに出す
+    void report(LogLevel level);
+}
+
+#endif //IDLE_HPP
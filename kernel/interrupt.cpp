@@ -1,7 +1,16 @@
 #include "interrupt.hpp"
 
+#include <atomic>
 #include <cstdint>
 
+#include "segment.hpp"
+
+namespace
+{
+    // ビット v: ベクタ v が割り当て済み
+    std::array<std::atomic<uint64_t>, 4> allocated_vectors{};
+}
+
 void set_IDT_entry(InterruptDescriptor& desc,
                    const InterruptDescriptorAttribute attr,
                    const uint64_t offset,
@@ -19,3 +28,30 @@ void notify_end_of_interrupt()
     const volatile auto end_of_interrupt = reinterpret_cast<uint32_t*>(0xfee000b0);
     *end_of_interrupt = 0;
 }
+
+WithError<uint8_t> allocate_interrupt_vector(const InterruptHandler handler)
+{
+    for (unsigned int vector = DYNAMIC_VECTOR_FIRST; vector <= DYNAMIC_VECTOR_LAST; ++vector)
+    {
+        auto& word = allocated_vectors[vector / 64];
+        const uint64_t bit = 1ull << (vector % 64);
+        // 他のコアと同時に割り当てても，ビットを立てられた方だけが使う
+        if ((word.fetch_or(bit, std::memory_order_acq_rel) & bit) == 0)
+        {
+            set_IDT_entry(idt[vector], make_IDT_attr(DescriptorType::InterruptGate, 0),
+                          reinterpret_cast<uint64_t>(handler), KERNEL_CS);
+            return {static_cast<uint8_t>(vector), MAKE_ERROR(Error::kSuccess)};
+        }
+    }
+    return {0, MAKE_ERROR(Error::kFull)};
+}
+
+void free_interrupt_vector(const uint8_t vector)
+{
+    if (vector < DYNAMIC_VECTOR_FIRST || DYNAMIC_VECTOR_LAST < vector)
+    {
+        return;
+    }
+    idt[vector] = {};
+    allocated_vectors[vector / 64].fetch_and(~(1ull << (vector % 64)), std::memory_order_release);
+}
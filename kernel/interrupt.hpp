@@ -2,7 +2,9 @@
 #define INTERRUPT_HPP
 
 #include <array>
+#include <cstdint>
 
+#include "error.hpp"
 #include "x86_descriptor.hpp"
 
 union InterruptDescriptorAttribute {
@@ -47,10 +49,15 @@ void set_IDT_entry(InterruptDescriptor &desc,
                    uint64_t offset,
                    uint16_t segment_selector);
 
+// 用途の決まった割り込みベクタ
+// デバイスのMSI/MSI-Xにはallocate_interrupt_vector()で割り当てたベクタを使う
 class InterruptVector {
 public:
     enum Number {
-        XHCI = 0x40,
+        Serial = 0x41,
+        LAPICTimer = 0x42,
+        // 眠っているコアを起こすだけのプロセッサ間割り込み
+        Wakeup = 0x43,
     };
 };
 
@@ -62,6 +69,36 @@ struct InterruptFrame {
     uint64_t ss;
 };
 
+using InterruptHandler = void (*)(InterruptFrame *frame);
+
+// allocate_interrupt_vector()が割り当てるベクタの範囲
+// 固定のベクタより上で、スプリアス割り込みの0xffは避ける
+constexpr uint8_t DYNAMIC_VECTOR_FIRST = 0x50;
+constexpr uint8_t DYNAMIC_VECTOR_LAST = 0xef;
+
+// 空いているベクタを1つ割り当て、IDTにhandlerを登録する。空きがなければkFullを返す
+// IDTは全コアで共有しているので、どのコアに届けるベクタにも使える
+WithError<uint8_t> allocate_interrupt_vector(InterruptHandler handler);
+// 割り込みが届かなくなってから返す
+void free_interrupt_vector(uint8_t vector);
+
+// Local APICのレジスタが並ぶ領域
+constexpr uintptr_t LOCAL_APIC_BASE = 0xfee00000;
+
 void notify_end_of_interrupt();
 
+// 割り込みを禁止し、禁止する前のRFLAGSを返す
+inline uint64_t save_and_disable_interrupts() {
+    uint64_t rflags;
+    __asm__ volatile("pushfq\n\tpopq %0\n\tcli" : "=r"(rflags) :: "memory");
+    return rflags;
+}
+
+// save_and_disable_interrupts() の前に割り込みが許可されていれば、再び許可する
+inline void restore_interrupts(const uint64_t rflags) {
+    if (rflags & (1u << 9)) {
+        __asm__ volatile("sti" ::: "memory");
+    }
+}
+
 #endif //INTERRUPT_HPP
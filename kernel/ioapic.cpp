@@ -0,0 +1,52 @@
+#include "ioapic.hpp"
+
+#include "asmfunc.hpp"
+
+namespace
+{
+    uintptr_t ioapic_base = ioapic::DEFAULT_BASE;
+
+    uint32_t read_register(const uint8_t index)
+    {
+        *reinterpret_cast<volatile uint32_t*>(ioapic_base) = index;
+        return *reinterpret_cast<volatile uint32_t*>(ioapic_base + 0x10);
+    }
+
+    void write_register(const uint8_t index, const uint32_t value)
+    {
+        *reinterpret_cast<volatile uint32_t*>(ioapic_base) = index;
+        *reinterpret_cast<volatile uint32_t*>(ioapic_base + 0x10) = value;
+    }
+
+    constexpr uint8_t redirection_entry(const uint8_t irq)
+    {
+        return 0x10 + 2 * irq;
+    }
+}
+
+namespace ioapic
+{
+    void set_base(const uintptr_t base)
+    {
+        ioapic_base = base;
+    }
+
+    void route(const uint8_t irq, const uint8_t vector, const uint8_t apic_id)
+    {
+        // 上位: 宛先の Local APIC ID
+        // 下位: Fixed, 物理宛先モード, High アクティブ, エッジトリガ, マスクなし
+        write_register(redirection_entry(irq) + 1, static_cast<uint32_t>(apic_id) << 24);
+        write_register(redirection_entry(irq), vector);
+    }
+
+    void mask(const uint8_t irq)
+    {
+        write_register(redirection_entry(irq), read_register(redirection_entry(irq)) | 1u << 16);
+    }
+
+    void disable_legacy_pic()
+    {
+        IoOut8(0xa1, 0xff);
+        IoOut8(0x21, 0xff);
+    }
+}
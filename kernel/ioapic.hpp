@@ -0,0 +1,28 @@
+#ifndef IOAPIC_HPP
+#define IOAPIC_HPP
+
+#include <cstdint>
+
+/**
+ * @file ioapic.hpp
+ *
+ * I/O APIC のリダイレクションテーブルを設定する機能を提供する．
+ * ISA の割り込み（シリアルポートなど）を Local APIC のベクタに届けるために使う．
+ */
+
+namespace ioapic
+{
+    // ACPI で別のアドレスが示されなければ，I/O APIC はこの番地にある
+    constexpr uintptr_t DEFAULT_BASE = 0xfec00000;
+
+    void set_base(uintptr_t base);
+
+    // 入力 irq の割り込みを，apic_id のコアに vector としてエッジトリガで届ける
+    void route(uint8_t irq, uint8_t vector, uint8_t apic_id);
+    void mask(uint8_t irq);
+
+    // 8259 PIC からの割り込みをすべてマスクする
+    void disable_legacy_pic();
+}
+
+#endif //IOAPIC_HPP
@@ -0,0 +1,244 @@
+#include "layer.hpp"
+
+Rectangle<int> Layer::rect() const
+{
+    if (!window_)
+    {
+        return {position_, {0, 0}};
+    }
+    return {position_, {window_->width(), window_->height()}};
+}
+
+void Layer::draw_to(PixelWriter& writer, const Rectangle<int>& area) const
+{
+    if (!window_)
+    {
+        return;
+    }
+    const auto visible = area & rect();
+    if (visible.empty())
+    {
+        return;
+    }
+    window_->draw_to(writer, position_, visible);
+}
+
+void LayerManager::set_writer(PixelWriter* writer)
+{
+    this->writer = writer;
+}
+
+void LayerManager::set_sprite(Sprite* sprite)
+{
+    this->sprite = sprite;
+}
+
+Layer* LayerManager::new_layer()
+{
+    if (num_layers == MAX_LAYERS)
+    {
+        return nullptr;
+    }
+    auto& layer = layers[num_layers];
+    ++num_layers;
+    layer = Layer{static_cast<unsigned int>(num_layers)};
+    return &layer;
+}
+
+void LayerManager::draw(const Rectangle<int>& area) const
+{
+    if (!writer || area.empty())
+    {
+        return;
+    }
+
+    // 領域全体を覆う不透明なレイヤーがあれば，それより下は見えないので描かない
+    int start = 0;
+    for (int h = stack_size - 1; h >= 0; --h)
+    {
+        if (layer_stack[h]->opaque() && layer_stack[h]->rect().contains(area))
+        {
+            start = h;
+            break;
+        }
+    }
+
+    for (int h = start; h < stack_size; ++h)
+    {
+        const auto part = area & layer_stack[h]->rect();
+        if (part.empty())
+        {
+            continue;
+        }
+
+        // 上にある不透明なレイヤーに完全に隠れる部分は描かない
+        bool occluded = false;
+        for (int above = h + 1; above < stack_size; ++above)
+        {
+            if (layer_stack[above]->opaque() && layer_stack[above]->rect().contains(part))
+            {
+                occluded = true;
+                break;
+            }
+        }
+        if (!occluded)
+        {
+            layer_stack[h]->draw_to(*writer, part);
+        }
+    }
+
+    if (sprite)
+    {
+        sprite->on_redrawn(*writer, area);
+    }
+}
+
+void LayerManager::draw(const unsigned int id) const
+{
+    if (const auto layer = find_layer(id))
+    {
+        draw(layer->rect());
+    }
+}
+
+void LayerManager::draw(const unsigned int id, const Rectangle<int>& area) const
+{
+    if (const auto layer = find_layer(id))
+    {
+        const auto rect = layer->rect();
+        draw(Rectangle<int>{rect.pos + area.pos, area.size} & rect);
+    }
+}
+
+void LayerManager::move_to(Layer* layer, const Vector2D<int> new_position)
+{
+    const auto old_rect = layer->rect();
+    layer->move(new_position);
+    if (height_of(layer) < 0)
+    {
+        return;
+    }
+
+    // 小さな移動では新旧の領域が重なるので，まとめて1回で描き直す
+    const auto new_rect = layer->rect();
+    if ((old_rect & new_rect).empty())
+    {
+        draw(old_rect);
+        draw(new_rect);
+    }
+    else
+    {
+        draw(old_rect | new_rect);
+    }
+}
+
+void LayerManager::move(const unsigned int id, const Vector2D<int> new_position)
+{
+    if (const auto layer = find_layer(id))
+    {
+        move_to(layer, new_position);
+    }
+}
+
+void LayerManager::move_relative(const unsigned int id, const Vector2D<int> diff)
+{
+    if (const auto layer = find_layer(id))
+    {
+        move_to(layer, layer->position() + diff);
+    }
+}
+
+void LayerManager::up_down(const unsigned int id, int new_height)
+{
+    if (new_height < 0)
+    {
+        hide(id);
+        return;
+    }
+
+    const auto layer = find_layer(id);
+    if (!layer)
+    {
+        return;
+    }
+
+    const int old_height = height_of(layer);
+    if (old_height < 0)
+    {
+        if (new_height > stack_size)
+        {
+            new_height = stack_size;
+        }
+        for (int h = stack_size; h > new_height; --h)
+        {
+            layer_stack[h] = layer_stack[h - 1];
+        }
+        layer_stack[new_height] = layer;
+        ++stack_size;
+        return;
+    }
+
+    if (new_height >= stack_size)
+    {
+        new_height = stack_size - 1;
+    }
+    if (new_height < old_height)
+    {
+        for (int h = old_height; h > new_height; --h)
+        {
+            layer_stack[h] = layer_stack[h - 1];
+        }
+    }
+    else
+    {
+        for (int h = old_height; h < new_height; ++h)
+        {
+            layer_stack[h] = layer_stack[h + 1];
+        }
+    }
+    layer_stack[new_height] = layer;
+}
+
+void LayerManager::hide(const unsigned int id)
+{
+    const auto layer = find_layer(id);
+    const int height = height_of(layer);
+    if (height < 0)
+    {
+        return;
+    }
+    for (int h = height; h < stack_size - 1; ++h)
+    {
+        layer_stack[h] = layer_stack[h + 1];
+    }
+    --stack_size;
+}
+
+Layer* LayerManager::find_layer(const unsigned int id)
+{
+    for (int i = 0; i < num_layers; ++i)
+    {
+        if (layers[i].id() == id)
+        {
+            return &layers[i];
+        }
+    }
+    return nullptr;
+}
+
+const Layer* LayerManager::find_layer(const unsigned int id) const
+{
+    return const_cast<LayerManager*>(this)->find_layer(id);
+}
+
+int LayerManager::height_of(const Layer* layer) const
+{
+    for (int h = 0; h < stack_size; ++h)
+    {
+        if (layer_stack[h] == layer)
+        {
+            return h;
+        }
+    }
+    return -1;
+}
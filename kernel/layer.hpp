@@ -0,0 +1,143 @@
+#ifndef LAYER_HPP
+#define LAYER_HPP
+
+#include <array>
+
+#include "graphics.hpp"
+#include "window.hpp"
+
+/**
+ * 画面上の位置を持ち，1つのウィンドウを表示する重ね合わせの単位．
+ */
+class Layer
+{
+public:
+    Layer() : Layer(0)
+    {
+    }
+
+    explicit Layer(unsigned int id) : id_{id}, window_{nullptr}, position_{0, 0}
+    {
+    }
+
+    [[nodiscard]] unsigned int id() const
+    {
+        return id_;
+    }
+
+    Layer& set_window(Window* window)
+    {
+        window_ = window;
+        return *this;
+    }
+
+    [[nodiscard]] Window* window() const
+    {
+        return window_;
+    }
+
+    [[nodiscard]] Vector2D<int> position() const
+    {
+        return position_;
+    }
+
+    Layer& move(Vector2D<int> pos)
+    {
+        position_ = pos;
+        return *this;
+    }
+
+    Layer& move_relative(Vector2D<int> diff)
+    {
+        position_ += diff;
+        return *this;
+    }
+
+    // 画面上でレイヤーが占める矩形
+    [[nodiscard]] Rectangle<int> rect() const;
+
+    [[nodiscard]] bool opaque() const
+    {
+        return window_ && window_->opaque();
+    }
+
+    // 画面上の領域 area のうちレイヤーに重なる部分を writer に描く
+    void draw_to(PixelWriter& writer, const Rectangle<int>& area) const;
+
+private:
+    unsigned int id_;
+    Window* window_;
+    Vector2D<int> position_;
+};
+
+/**
+ * レイヤーの重ね合わせの後で画面に直接描かれるもの（マウスカーソルなど）．
+ * 描かれている場所が描き直されたら，on_redrawn で自分の下の内容を取り直して描き直す．
+ */
+class Sprite
+{
+public:
+    virtual ~Sprite() = default;
+    virtual void on_redrawn(PixelWriter& writer, const Rectangle<int>& area) = 0;
+};
+
+/**
+ * レイヤーの重なり順を管理し，変更のあった領域だけを画面に描き直す．
+ *
+ * 描き直しでは領域を完全に覆う不透明なレイヤーより下は描かず，
+ * 上にある不透明なレイヤーに隠れてしまうレイヤーも飛ばす．
+ * そのため描き直しの手間は変更された面積に比例し，レイヤーの数にはほとんど依らない．
+ */
+class LayerManager
+{
+public:
+    static constexpr int MAX_LAYERS = 16;
+
+    void set_writer(PixelWriter* writer);
+    void set_sprite(Sprite* sprite);
+
+    // 新しいレイヤーを生成する．生成直後は非表示．空きがなければnullptrを返す
+    Layer* new_layer();
+
+    // 画面上の領域 area を描き直す
+    void draw(const Rectangle<int>& area) const;
+    // レイヤー全体を描き直す
+    void draw(unsigned int id) const;
+    // レイヤー内の領域 area（レイヤー左上からの相対座標）を描き直す
+    void draw(unsigned int id, const Rectangle<int>& area) const;
+
+    // レイヤーを移動し，移動前後の領域を描き直す
+    void move(unsigned int id, Vector2D<int> new_position);
+    void move_relative(unsigned int id, Vector2D<int> diff);
+
+    // 重なり順を変更する．0が最も下．負の値なら非表示にする
+    void up_down(unsigned int id, int new_height);
+    void hide(unsigned int id);
+
+    void* operator new(size_t size, void* buf)
+    {
+        return buf;
+    }
+
+    void operator delete(void* obj) noexcept
+    {
+    }
+
+private:
+    [[nodiscard]] Layer* find_layer(unsigned int id);
+    [[nodiscard]] const Layer* find_layer(unsigned int id) const;
+    // 重なり順でのレイヤーの位置．表示されていなければ -1
+    [[nodiscard]] int height_of(const Layer* layer) const;
+    void move_to(Layer* layer, Vector2D<int> new_position);
+
+    PixelWriter* writer{nullptr};
+    Sprite* sprite{nullptr};
+    std::array<Layer, MAX_LAYERS> layers{};
+    int num_layers{0};
+    // 表示中のレイヤーを下から順に並べたもの
+    std::array<Layer*, MAX_LAYERS> layer_stack{};
+    int stack_size{0};
+};
+
+
+#endif //LAYER_HPP
@@ -1,42 +1,90 @@
 #include "logger.hpp"
 
+#include <cstdarg>
+#include <cstdint>
 #include <cstdio>
 
 #include "console.hpp"
+#include "interrupt.hpp"
+#include "serial.hpp"
+#include "trace.hpp"
+
+extern Console* console;
+extern SerialPort* serial_port;
 
 namespace
 {
     auto log_level = kInfo;
-}
+    unsigned int log_output = kLogToConsole | kLogToSerial;
 
-extern Console* console;
+    // TRACE() の記録はコンパイル時の TRACE_LEVEL で絞った上で，取り出すときに実行時のレベルでも絞る
+    void write_to_outputs(const LogLevel level, const char* s)
+    {
+        if (level <= log_level)
+        {
+            write_log_output(s);
+        }
+    }
+}
 
 void set_log_level(const LogLevel level)
 {
     log_level = level;
 }
 
-int log(const LogLevel level, const char* format, ...)
+void set_log_output(const unsigned int outputs)
+{
+    log_output = outputs;
+}
+
+void write_log_output(const char* s)
+{
+    // 出力の途中で他のタスクに切り替わり，行が混ざらないようにする
+    const auto rflags = save_and_disable_interrupts();
+    if ((log_output & kLogToSerial) && serial_port)
+    {
+        serial_port->write(s);
+    }
+    if ((log_output & kLogToConsole) && console)
+    {
+        console->put_string(s);
+    }
+    restore_interrupts(rflags);
+}
+
+int vlog(const LogLevel level, const char* format, va_list ap)
 {
     if (level > log_level)
     {
         return 0;
     }
 
-    va_list ap;
     char s[1024];
+    const int result = vsnprintf(s, sizeof(s), format, ap);
+    write_log_output(s);
+    return result;
+}
 
+int log(const LogLevel level, const char* format, ...)
+{
+    va_list ap;
     va_start(ap, format);
-    const int result = vsnprintf(s, sizeof(s), format, ap);
+    const int result = vlog(level, format, ap);
     va_end(ap);
-
-    console->put_string(s);
     return result;
 }
 
 // alias
 int Log(const LogLevel level, const char* format, ...)
 {
-    return log(level, format);
+    va_list ap;
+    va_start(ap, format);
+    const int result = vlog(level, format, ap);
+    va_end(ap);
+    return result;
 }
 
+void flush_log()
+{
+    drain_trace(write_to_outputs);
+}
@@ -1,6 +1,8 @@
 #ifndef LOGGER_HPP
 #define LOGGER_HPP
 
+#include <cstdarg>
+
 enum LogLevel
 {
     kError = 3,
@@ -9,10 +11,25 @@ enum LogLevel
     kDebug = 7,
 };
 
+// ログの出力先
+enum LogOutput
+{
+    kLogToConsole = 1u << 0,
+    kLogToSerial = 1u << 1,
+};
+
 void set_log_level(LogLevel level);
+// 出力先を LogOutput の論理和で指定する．用意されていない出力先は無視される
+void set_log_output(unsigned int outputs);
+// 有効な出力先すべてに文字列を書く
+void write_log_output(const char* s);
 
 int log(LogLevel level, const char* format, ...);
+int vlog(LogLevel level, const char* format, va_list ap);
 int Log(LogLevel level, const char* format, ...);
 
+// TRACE() で記録したログを書式化して出力する．log() は呼んだときに出力する
+void flush_log();
+
 
 #endif //LOGGER_HPP
@@ -1,29 +1,104 @@
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <new>
 
+#include "acpi.hpp"
 #include "asmfunc.hpp"
+#include "buddy.hpp"
 #include "console.hpp"
+#include "cpu.hpp"
+#include "event.hpp"
+#include "frame_manager.hpp"
 #include "frame_buffer_config.hpp"
 #include "graphics.hpp"
+#include "heap.hpp"
+#include "idle.hpp"
 #include "interrupt.hpp"
+#include "ioapic.hpp"
+#include "layer.hpp"
 #include "logger.hpp"
+#include "paging.hpp"
 #include "pci.hpp"
 #include "memory_map.hpp"
 #include "mouse.hpp"
-#include "queue.hpp"
+#include "serial.hpp"
+#include "shadow_buffer.hpp"
+#include "task.hpp"
+#include "timer.hpp"
+#include "timing.hpp"
+#include "trace.hpp"
+#include "window.hpp"
+#include "workqueue.hpp"
+#include "xhci_interrupter.hpp"
 #include "usb/xhci/xhci.hpp"
 #include "usb/classdriver/mouse.hpp"
 
+// 起動時に描画やコンソールの速さを測ってログに出すか(-DBOOT_BENCHMARK=1で有効にする)
+// 画面全体を何度も塗り、ログを何度も出し直すので、既定では測らない
+#ifndef BOOT_BENCHMARK
+#define BOOT_BENCHMARK 0
+#endif
+
+// xHCのセカンダリインタラプタをいくつ使うか(-DXHC_SECONDARY_INTERRUPTERS=nで設定する)
+// HIDのエンドポイントの転送TRBにInterrupter Targetを設定するドライバの変更と合わせて有効にする
+// それまではどの転送のイベントも届かないので、既定では使わない
+#ifndef XHC_SECONDARY_INTERRUPTERS
+#define XHC_SECONDARY_INTERRUPTERS 0
+#endif
+
 constexpr PixelColor DESKTOP_BG_COLOR{45, 118, 237};
 constexpr PixelColor DESKTOP_FG_COLOR{255, 255, 255};
 
 
-char pixel_writer_buf[sizeof(RGBResv8BitPerColorPixelWriter)];
+char pixel_writer_buf[PIXEL_WRITER_BUF_SIZE];
 PixelWriter *pixel_writer;
 
+// シャドウバッファ。確保できなければフレームバッファへ直接描画する
+FrameBufferConfig shadow_frame_buffer_config;
+char shadow_pixel_writer_buf[PIXEL_WRITER_BUF_SIZE];
+char shadow_frame_buffer_buf[sizeof(ShadowFrameBuffer)];
+ShadowFrameBuffer *shadow_frame_buffer;
+
+char layer_manager_buf[sizeof(LayerManager)];
+LayerManager *layer_manager;
+
+// デスクトップ(背景とタスクバー)を描くウィンドウ
+char desktop_window_buf[sizeof(Window)];
+
+// コンソールを描くウィンドウ
+alignas(64) uint32_t console_window_mem[8 * Console::COLUMNS * 16 * Console::ROWS];
+char console_window_buf[sizeof(Window)];
+
 char console_buf[sizeof(Console)];
 Console *console;
 
+// 起動時や定期的にログへ出す処理時間
+LatencyStats scan_all_bus_latency;
+LatencyStats xhc_initialize_latency;
+LatencyStats configure_port_latency;
+LatencyStats console_render_latency;
+
+// 後回しにしたログを書式化してコンソールに書き込み、コンソールに溜まった文字列を描き、
+// シャドウバッファに溜まった変更を画面に反映する
+void flush_screen() {
+    flush_log();
+    if (console) {
+        ScopedTimer timer{console_render_latency};
+        console->render();
+    }
+    if (shadow_frame_buffer) {
+        shadow_frame_buffer->flush();
+    }
+}
+
+// ログの出力先となるCOM1。見つからなければnullptrのまま
+char serial_port_buf[sizeof(SerialPort)];
+SerialPort *serial_port;
+// 最後にログへ報告したときのシリアルポートの取りこぼし数
+uint64_t serial_reported_dropped;
+
 int printk(const char *format, ...) {
     va_list ap;
     char s[1024];
@@ -32,10 +107,89 @@ int printk(const char *format, ...) {
     const int result = vsnprintf(s, sizeof(s), format, ap);
     va_end(ap);
 
-    console->put_string(s);
+    write_log_output(s);
     return result;
 }
 
+// メモリマップのうち使える領域を出力し、出力した行数を返す
+// render_each_lineなら1行毎にコンソールを描く
+int print_memory_map(const MemoryMap &memory_map, const bool render_each_line = false) {
+    std::array available_memory_types{
+        MemoryType::EfiBootServicesCode,
+        MemoryType::EfiBootServicesData,
+        MemoryType::EfiConventionalMemory,
+    };
+    int lines = 1;
+    printk("memory_map: %p\n", &memory_map);
+    for (auto iter = reinterpret_cast<uintptr_t>(memory_map.buffer);
+         iter < reinterpret_cast<uintptr_t>(memory_map.buffer) + memory_map.map_size;
+         iter += memory_map.descriptor_size) {
+        auto desc = reinterpret_cast<MemoryDescriptor *>(iter);
+        for (const auto &available_memory_type: available_memory_types) {
+            if (desc->type == available_memory_type) {
+                printk("type = %u, phys = %08lx - %08lx, pages = %lu, attr = %08lx\n",
+                       desc->type,
+                       desc->physical_start,
+                       desc->physical_start + desc->number_of_pages * 4096 - 1,
+                       desc->number_of_pages,
+                       desc->attribute);
+                ++lines;
+                if (render_each_line) {
+                    console->render();
+                }
+            }
+        }
+    }
+    return lines;
+}
+
+// 見つかったPCIデバイスを出力し、出力した行数を返す
+int print_pci_devices(const bool render_each_line = false) {
+    for (int i = 0; i < pci::num_devices; ++i) {
+        const auto &dev = pci::devices[i];
+        auto vendor_id = pci::read_vendor_id(dev);
+        auto class_code = pci::read_class_code(dev.bus, dev.device, dev.function);
+        printk("%d.%d.%d: vend %04x, class %08x, head %02x\n",
+               dev.bus, dev.device, dev.function,
+               vendor_id, class_code, dev.header_type);
+        if (render_each_line) {
+            console->render();
+        }
+    }
+    return pci::num_devices;
+}
+
+// 起動時のメモリマップとPCIデバイスの出力を作業量に、描画込みで1秒に何行出せるかを測る
+// 改行毎に全体を描き直す以前の描き方と、行を移してスクロールする今の描き方を、どちらも1行毎に描いて比べる
+// 今の描き方はまとめて描く場合も測る
+constexpr int CONSOLE_BENCHMARK_ROUNDS = 2;
+
+struct ConsoleRates {
+    uint64_t repaint;
+    uint64_t per_line;
+    uint64_t batched;
+};
+
+uint64_t measure_console_rate(const MemoryMap &memory_map, const bool render_each_line) {
+    const uint64_t start = timing::now();
+    uint64_t lines = 0;
+    for (int i = 0; i < CONSOLE_BENCHMARK_ROUNDS; ++i) {
+        lines += print_memory_map(memory_map, render_each_line);
+        lines += print_pci_devices(render_each_line);
+        console->render();
+    }
+    const uint64_t ns = timing::to_nanoseconds(timing::now() - start);
+    return ns ? lines * 1'000'000'000 / ns : 0;
+}
+
+ConsoleRates measure_console_rates(const MemoryMap &memory_map) {
+    console->set_repaint_on_scroll(true);
+    const uint64_t repaint = measure_console_rate(memory_map, true);
+    console->set_repaint_on_scroll(false);
+    const uint64_t per_line = measure_console_rate(memory_map, true);
+    return {repaint, per_line, measure_console_rate(memory_map, false)};
+}
+
 void switch_ehci2xhci(pci::Device xhc_dev) {
     bool intel_ehc_exist = false;
     for (int i = 0; i < pci::num_devices; ++i) {
@@ -60,91 +214,538 @@ void switch_ehci2xhci(pci::Device xhc_dev) {
 char mouse_cursor_buf[sizeof(MouseCursor)];
 MouseCursor *mouse_cursor;
 
+// 割り込みハンドラやドライバからのメッセージを優先度順にメインループへ届ける
+// BSPのコア毎データにあるものを指す
+EventDispatcher *event_dispatcher;
+
+char task_manager_buf[sizeof(TaskManager)];
+TaskManager *task_manager;
+
+// 割り込みハンドラからメインループに通知し、メインタスクが眠っていれば起こす
+void notify_main_loop(const Message::Type type) {
+    event_dispatcher->notify(type);
+    if (task_manager) {
+        task_manager->wakeup(task_manager->main_task());
+    }
+}
+
+// まだカーソルに反映していないマウスの移動量
+// xHCのイベント処理の中で何回報告されても、カーソルの描き直しは1回にまとめる
+Vector2D<int> pending_mouse_displacement{0, 0};
+
 void mouse_observer(int8_t displacement_x, int8_t displacement_y) {
-    mouse_cursor->move_relative({displacement_x, displacement_y});
+    pending_mouse_displacement += Vector2D<int>{displacement_x, displacement_y};
+    event_dispatcher->notify(Message::Type::MouseMove);
+}
+
+void on_mouse_move(const Message &msg) {
+    const auto displacement = pending_mouse_displacement;
+    pending_mouse_displacement = {0, 0};
+    mouse_cursor->move_relative(displacement);
 }
 
 usb::xhci::Controller *xhc;
 
-struct Message {
-    enum class Type {
-        InterruptXHCI,
-    } type;
-};
+// xHCのレジスタ領域として扱う大きさ(ページテーブルには2MiB単位で反映される)
+constexpr size_t XHC_MMIO_SIZE = 64 * 1024;
 
-ArrayQueue<Message> *main_queue;
+void on_xhci_event(const Message &msg) {
+    int num_events = 0;
+    while (xhc->PrimaryEventRing()->HasFront()) {
+        if (auto err = usb::xhci::ProcessEvent(*xhc)) {
+            log(kError, "Error while ProcessingEvent: %s at %s:%d\n",
+                err.Name(), err.File(), err.Line());
+        }
+        ++num_events;
+    }
+    TRACE(kDebug, "xhci: %ld events\n", num_events);
+}
 
 // xHCの割り込みハンドラ
+// 何回割り込まれてもイベントリングを1回読めばよいので、メッセージは積まずに通知だけする
 __attribute__((interrupt))
 void int_handler_xhci(InterruptFrame *frame) {
-    main_queue->push(Message{Message::Type::InterruptXHCI});
+    notify_main_loop(Message::Type::InterruptXHCI);
+    notify_end_of_interrupt();
+}
+
+// xHCのセカンダリインタラプタ。インタラプタ毎に別のMSI-Xのベクタで割り込む
+constexpr int MAX_XHC_SECONDARY_INTERRUPTERS = 4;
+static_assert(XHC_SECONDARY_INTERRUPTERS <= MAX_XHC_SECONDARY_INTERRUPTERS, "too many xHC interrupters");
+char xhc_interrupter_buf[MAX_XHC_SECONDARY_INTERRUPTERS][sizeof(XhcInterrupter)];
+XhcInterrupter *xhc_interrupters[MAX_XHC_SECONDARY_INTERRUPTERS];
+int num_xhc_interrupters;
+
+// どのセカンダリインタラプタのベクタもこのハンドラに届く。ベクタを分けるのは宛先のコアを分けられるようにするため
+__attribute__((interrupt))
+void int_handler_xhci_secondary(InterruptFrame *frame) {
+    notify_main_loop(Message::Type::InterruptXHCISecondary);
+    notify_end_of_interrupt();
+}
+
+// セカンダリインタラプタのイベントリングを空にする
+// イベントの処理はドライバの変更で、ここからドライバのイベント処理に渡す
+void on_xhci_secondary_event(const Message &msg) {
+    for (int i = 0; i < num_xhc_interrupters; ++i) {
+        auto &interrupter = *xhc_interrupters[i];
+        if (!interrupter.has_front()) {
+            continue;
+        }
+        while (interrupter.has_front()) {
+            TRACE(kDebug, "xhci: interrupter %lu event type %lu\n", interrupter.index(), interrupter.front().type());
+            interrupter.pop();
+        }
+        interrupter.acknowledge();
+    }
+}
+
+// インタラプタ1から順に、イベントリングとMSI-Xのエントリ(エントリiがインタラプタiに対応する)を設定する
+void setup_xhc_secondary_interrupters(const uintptr_t mmio_base, const pci::MSIX &msix, const uint8_t apic_id) {
+    const unsigned int available = std::min(XhcInterrupter::max_interrupters(mmio_base), msix.num_entries);
+    for (unsigned int index = 1; index <= XHC_SECONDARY_INTERRUPTERS && index < available; ++index) {
+        const auto vector = allocate_interrupt_vector(int_handler_xhci_secondary);
+        if (vector.error) {
+            log(kError, "Failed to allocate an interrupt vector for xHC interrupter %u: %s\n",
+                index, vector.error.Name());
+            break;
+        }
+        auto interrupter = new(xhc_interrupter_buf[num_xhc_interrupters]) XhcInterrupter;
+        if (auto err = interrupter->initialize(mmio_base, index, *dma_allocator)) {
+            log(kError, "Failed to set up xHC interrupter %u: %s\n", index, err.Name());
+            free_interrupt_vector(vector.value);
+            break;
+        }
+        pci::configure_msix_entry(msix, index, apic_id, pci::MSITriggerMode::Edge,
+                                  pci::MSIDeliveryMode::Fixed, vector.value);
+        xhc_interrupters[num_xhc_interrupters++] = interrupter;
+        log(kInfo, "xHC interrupter %u: vector 0x%02x\n", index, vector.value);
+    }
+    // 入力のイベントを受けるので最優先で処理する
+    event_dispatcher->set_handler(Message::Type::InterruptXHCISecondary, EventDispatcher::kHigh,
+                                  on_xhci_secondary_event);
+}
+
+char timer_manager_buf[sizeof(TimerManager)];
+TimerManager *timer_manager;
+
+// Local APICタイマーの割り込みハンドラ
+// 期限の処理はメインループで行うので、ここでは通知し、タイムスライスを使い切っていればタスクを切り替える
+__attribute__((interrupt))
+void int_handler_lapic_timer(InterruptFrame *frame) {
+    notify_main_loop(Message::Type::TimerTimeout);
+    timer_manager->on_interrupt();
     notify_end_of_interrupt();
+    if (task_manager) {
+        task_manager->on_timer_interrupt();
+    }
+}
+
+void on_timer(const Message &msg) {
+    timer_manager->process();
+}
+
+constexpr uint64_t LATENCY_REPORT_INTERVAL_MS = 10000;
+constexpr int IDLE_MAX_CSTATE = 6;
+
+void report_latency(Timer &timer) {
+    console_render_latency.report("Console::render", kDebug);
+    idle::report(kDebug);
+    heap::report(kDebug);
+    // 送信が追いつかずに捨てた分があれば報告する。このログ自体も入りきらなければ捨てられる
+    if (serial_port && serial_port->dropped() != serial_reported_dropped) {
+        const uint64_t dropped = serial_port->dropped();
+        log(kWarn, "serial: %lu bytes dropped\n", dropped - serial_reported_dropped);
+        serial_reported_dropped = dropped;
+    }
+    timer_manager->arm(timer, LATENCY_REPORT_INTERVAL_MS);
+}
+
+// シリアルポートで受信した文字。割り込みハンドラの中で呼ばれる
+// 文字は1つずつ意味を持ちまとめられないので、通知ではなくメッセージとしてキューに入れる
+void serial_observer(const char c) {
+    Message msg{Message::Type::SerialReceived, {}};
+    msg.arg.serial.c = c;
+    event_dispatcher->post(msg);
+}
+
+// 受信した文字をエコーバックする。端末のEnterはCRで届くので改行にする
+void on_serial_received(const Message &msg) {
+    const char c = msg.arg.serial.c;
+    printk("%c", c == '\r' ? '\n' : c);
+}
+
+// シリアルポートの割り込みハンドラ
+// 受信した文字はon_interrupt()の中でキューに入るので、メインタスクを起こす
+__attribute__((interrupt))
+void int_handler_serial(InterruptFrame *frame) {
+    serial_port->on_interrupt();
+    if (task_manager) {
+        task_manager->wakeup(task_manager->main_task());
+    }
+    notify_end_of_interrupt();
+}
+
+// 他のコアから起こされるための割り込み
+// 起きた後はイベントループが仕事を探すので、ここではBSPのメインタスクを起こすだけにする
+// タスクはBSPでしか動かないので、APではEOIだけを送る
+__attribute__((interrupt))
+void int_handler_wakeup(InterruptFrame *frame) {
+    if (task_manager && this_cpu().index == 0) {
+        task_manager->wakeup(task_manager->main_task());
+    }
+    notify_end_of_interrupt();
+}
+
+// どのタスクも動けないときにアイドルタスクが呼ぶ
+// 割り込みやほかのコアからの通知でメインループに仕事が来ていれば、メインタスクを起こす
+void idle_until_work(void *) {
+    idle::wait_for_work(*event_dispatcher);
+    if (event_dispatcher->has_work()) {
+        task_manager->wakeup(task_manager->main_task());
+    }
+}
+
+// フレームバッファへ直接、画面全体をfill_rectangleで塗る速さ(Mpixel/s)を測る
+constexpr int FILL_BENCHMARK_ROUNDS = 8;
+
+uint64_t measure_fill_rate(const FrameBufferConfig &config) {
+    char writer_buf[PIXEL_WRITER_BUF_SIZE];
+    auto writer = new_pixel_writer(writer_buf, config);
+    const int width = writer->width();
+    const int height = writer->height();
+
+    const uint64_t start = timing::now();
+    for (int i = 0; i < FILL_BENCHMARK_ROUNDS; ++i) {
+        fill_rectangle(*writer, {0, 0}, {width, height}, DESKTOP_BG_COLOR);
+    }
+    const uint64_t ns = timing::to_nanoseconds(timing::now() - start);
+    return ns ? static_cast<uint64_t>(width) * height * FILL_BENCHMARK_ROUNDS * 1000 / ns : 0;
 }
 
+// 同じwriterで画面全体を、1ピクセルずつwrite()で塗る速さとfill_rectで行毎にまとめて塗る速さ(Mpixel/s)を比べる
+struct FillPathRates {
+    uint64_t per_pixel;
+    uint64_t span;
+};
+
+FillPathRates measure_fill_paths(const FrameBufferConfig &config) {
+    char writer_buf[PIXEL_WRITER_BUF_SIZE];
+    auto writer = new_pixel_writer(writer_buf, config);
+    const int width = writer->width();
+    const int height = writer->height();
+    const uint64_t pixels = static_cast<uint64_t>(width) * height * FILL_BENCHMARK_ROUNDS;
+
+    uint64_t start = timing::now();
+    for (int i = 0; i < FILL_BENCHMARK_ROUNDS; ++i) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                writer->write(x, y, DESKTOP_BG_COLOR);
+            }
+        }
+    }
+    const uint64_t per_pixel_ns = timing::to_nanoseconds(timing::now() - start);
+
+    const uint32_t pixel = writer->to_pixel(DESKTOP_BG_COLOR);
+    start = timing::now();
+    for (int i = 0; i < FILL_BENCHMARK_ROUNDS; ++i) {
+        writer->fill_rect({0, 0}, {width, height}, pixel);
+    }
+    const uint64_t span_ns = timing::to_nanoseconds(timing::now() - start);
+
+    return {per_pixel_ns ? pixels * 1000 / per_pixel_ns : 0, span_ns ? pixels * 1000 / span_ns : 0};
+}
+
+// 計算だけの仕事を全コアに分けたときの速さを、1コアで順に実行したときと比べる
+constexpr int FAN_OUT_ITEMS = 64;
+constexpr uint64_t FAN_OUT_ITERATIONS = 1'000'000;
+
+// 仕事ごとの結果。別々のキャッシュラインに置き、コア間で取り合わないようにする
+struct alignas(64) FanOutSlot {
+    uint64_t value;
+};
+
+void fan_out_work(void *arg) {
+    auto slot = static_cast<FanOutSlot *>(arg);
+    uint64_t x = slot->value;
+    for (uint64_t i = 0; i < FAN_OUT_ITERATIONS; ++i) {
+        x = x * 6364136223846793005u + 1442695040888963407u;
+        // ループをまとめて計算させない
+        __asm__ volatile("" : "+r"(x));
+    }
+    slot->value = x;
+}
+
+// かかった時間(ns)を返す
+uint64_t measure_fan_out(const bool parallel) {
+    FanOutSlot slots[FAN_OUT_ITEMS];
+    alignas(WorkItem) char items_buf[FAN_OUT_ITEMS][sizeof(WorkItem)];
+    WorkItem *items[FAN_OUT_ITEMS];
+    for (int i = 0; i < FAN_OUT_ITEMS; ++i) {
+        slots[i].value = i;
+        items[i] = new(items_buf[i]) WorkItem{fan_out_work, &slots[i]};
+    }
+
+    const uint64_t start = timing::now();
+    if (parallel) {
+        for (auto item: items) {
+            workqueue::submit(*item);
+        }
+        for (auto item: items) {
+            item->wait();
+        }
+    } else {
+        for (auto &slot: slots) {
+            fan_out_work(&slot);
+        }
+    }
+    return timing::to_nanoseconds(timing::now() - start);
+}
+
+// メインタスクと同じ優先度のタスクとyieldで交互に切り替え、1回の切り替えにかかる時間を測る
+constexpr int CONTEXT_SWITCH_ROUNDS = 100'000;
+
+struct ContextSwitchCost {
+    uint64_t ns;
+    uint64_t cycles;
+};
+
+void context_switch_peer(void *arg) {
+    auto stop = static_cast<volatile bool *>(arg);
+    while (!*stop) {
+        task_manager->yield();
+    }
+}
+
+ContextSwitchCost measure_context_switch() {
+    volatile bool stop = false;
+    task_manager->new_task(context_switch_peer, const_cast<bool *>(&stop), TaskManager::DEFAULT_PRIORITY);
+    // 相手のタスクを一度動かしてから測り始める
+    task_manager->yield();
+
+    const uint64_t switches_before = task_manager->switches();
+    const uint64_t start = timing::now();
+    const uint64_t start_cycles = __builtin_ia32_rdtsc();
+    for (int i = 0; i < CONTEXT_SWITCH_ROUNDS; ++i) {
+        task_manager->yield();
+    }
+    const uint64_t cycles = __builtin_ia32_rdtsc() - start_cycles;
+    const uint64_t ns = timing::to_nanoseconds(timing::now() - start);
+    const uint64_t switches = task_manager->switches() - switches_before;
+
+    // 相手のタスクを終わらせる
+    stop = true;
+    task_manager->yield();
+    return switches ? ContextSwitchCost{ns / switches, cycles / switches} : ContextSwitchCost{0, 0};
+}
+
+char frame_manager_buf[sizeof(FrameManager)];
+FrameManager *frame_manager;
+
+// DMA用に最大ブロック(4MiB)をいくつ切り出すか
+constexpr size_t DMA_POOL_BLOCKS = 4;
+// mallocがsbrkで切り出す領域の大きさ(4MiB)
+constexpr size_t MALLOC_ARENA_FRAMES = 1024;
+char dma_allocator_buf[sizeof(BuddyAllocator)];
+BuddyAllocator *dma_allocator;
+
+// メモリマップの記述子のコピー。ブートローダーが用意する領域と同じ大きさにする
+alignas(16) uint8_t memory_map_buf[4096 * 4];
+
 // スタック領域
 alignas(16) uint8_t kernel_main_stack[1024 * 1024];
 
 extern "C" [[noreturn]] void KernelMainNewStack(const FrameBufferConfig &frame_buffer_config_ref,
-                                                const MemoryMap &memory_map_ref) {
+                                                const MemoryMap &memory_map_ref,
+                                                const acpi::RSDP *acpi_table) {
     // ブートローダーの領域にあるデータをカーネルのスタック領域へコピー
     FrameBufferConfig frame_buffer_config{frame_buffer_config_ref};
     MemoryMap memory_map{memory_map_ref};
+    // 記述子の配列はブートローダーのスタック(EfiBootServicesData)にあり、フレームマネージャが空きとして配ってしまう
+    // 構造体だけでなく記述子もカーネルの領域へコピーし、以降はそちらを読む
+    memory_map.map_size = std::min<unsigned long long>(memory_map.map_size, sizeof(memory_map_buf));
+    memcpy(memory_map_buf, memory_map_ref.buffer, memory_map.map_size);
+    memory_map.buffer = memory_map_buf;
+    memory_map.buffer_size = sizeof(memory_map_buf);
+
+    // UEFIのページテーブルから、大きなページで恒等写像するカーネル自身のページテーブルに切り替える
+    // Local APICのレジスタはキャッシュしてはならない
+    paging::setup_identity_page_table();
+    paging::set_cache_mode(LOCAL_APIC_BASE, 4096, paging::CacheMode::kUncacheable);
+
+    // 起動ログをすべて取れるよう、シリアルポートは最初に用意する
+    // 送信は割り込みで行うので、割り込みの設定が済むまでは送信リングに溜まる
+    serial_port = new(serial_port_buf) SerialPort{SerialPort::COM1};
+    if (serial_port->initialize()) {
+        serial_port = nullptr;
+    }
 
-    switch (frame_buffer_config.pixel_format) {
-        case kPixelRGBResv8BitPerColor:
-            pixel_writer = new(pixel_writer_buf) RGBResv8BitPerColorPixelWriter{frame_buffer_config};
-            break;
-        case kPixelBGRResv8BitPerColor:
-            pixel_writer = new(pixel_writer_buf) BGRResv8BitPerColorPixelWriter{frame_buffer_config};
-            break;
+    // ACPIのMADTからプロセッサとI/O APICの構成を読む。読めなければBSPとI/O APICの既定の番地で動く
+    // I/O APICのレジスタもキャッシュしてはならない
+    if (auto err = acpi::initialize(acpi_table)) {
+        log(kWarn, "Failed to read ACPI tables: %s\n", err.Name());
     }
+    ioapic::set_base(acpi::ioapic_address());
+    paging::set_cache_mode(acpi::ioapic_address(), 4096, paging::CacheMode::kUncacheable);
+
+    // 使えるメモリをフレーム単位で管理する
+    frame_manager = new(frame_manager_buf) FrameManager;
+    if (auto err = frame_manager->initialize(memory_map)) {
+        log(kError, "Failed to initialize frame manager: %s\n", err.Name());
+    }
+    log(kInfo, "frames: %lu free / %lu usable (%lu MiB free)\n",
+        frame_manager->free_frames(), frame_manager->total_frames(),
+        frame_manager->free_frames() * BYTES_PER_FRAME / (1024 * 1024));
+
+    // デバイスとのDMAに使う、物理的に連続した領域のアロケータ
+    // 領域は最初に確保されたときに切り出すので、使うドライバがなければメモリを取らない
+    dma_allocator = new(dma_allocator_buf) BuddyAllocator;
+    dma_allocator->initialize_on_first_use(*frame_manager, DMA_POOL_BLOCKS);
+
+    // 画面の大きさのバッファなどはヒープから確保する。mallocが使う領域もここで用意する
+    if (auto err = heap::initialize(*frame_manager, MALLOC_ARENA_FRAMES)) {
+        log(kError, "Failed to initialize heap: %s\n", err.Name());
+    }
+
+    // BSPのコア毎データを作り、GDTとTSSをカーネルのものに切り替える
+    // IDTに登録するコードセグメントが変わるので、IDTの設定より前に行う
+    cpu::initialize_bsp(kernel_main_stack, sizeof(kernel_main_stack));
+    event_dispatcher = &this_cpu().dispatcher;
+    workqueue::initialize_this_cpu();
 
     const int FRAME_WIDTH = static_cast<int>(frame_buffer_config.horizontal_resolution);
     const int FRAME_HEIGHT = static_cast<int>(frame_buffer_config.vertical_resolution);
-    fill_rectangle(*pixel_writer, {0, 0}, {FRAME_WIDTH, FRAME_HEIGHT - 50}, DESKTOP_BG_COLOR);
-    fill_rectangle(*pixel_writer, {0, FRAME_WIDTH - 50}, {FRAME_WIDTH, 50}, {1, 8, 17});
-    fill_rectangle(*pixel_writer, {0, FRAME_WIDTH - 50}, {FRAME_WIDTH / 5, 50}, {80, 80, 80});
-    draw_rectangle(*pixel_writer, {10, FRAME_HEIGHT - 40}, {30, 30}, {160, 160, 160});
 
-    console = new(console_buf) Console{*pixel_writer, DESKTOP_FG_COLOR, DESKTOP_BG_COLOR};
-    printk("Welcom to MikanOS!\n");
+    // ピクセル形式による分岐はnew_pixel_writerでの1回だけで、以降の描画は形式専用のコードで行われる
+    auto shadow_frame_buffer_mem = new(std::nothrow) uint8_t[4 * FRAME_WIDTH * FRAME_HEIGHT];
+    if (shadow_frame_buffer_mem) {
+        // 描画はRAM上のシャドウバッファに行い、変更部分だけをまとめてフレームバッファへ書き出す
+        shadow_frame_buffer_config = frame_buffer_config;
+        shadow_frame_buffer_config.frame_buffer = shadow_frame_buffer_mem;
+        shadow_frame_buffer_config.pixels_per_scan_line = frame_buffer_config.horizontal_resolution;
+        auto shadow_writer = new_pixel_writer(shadow_pixel_writer_buf, shadow_frame_buffer_config);
+        shadow_frame_buffer = new(shadow_frame_buffer_buf) ShadowFrameBuffer{
+            shadow_frame_buffer_config, *shadow_writer, frame_buffer_config
+        };
+        pixel_writer = shadow_frame_buffer;
+    } else {
+        pixel_writer = new_pixel_writer(pixel_writer_buf, frame_buffer_config);
+    }
 
-    // メモリマップを出力
-    std::array available_memory_types{
-        MemoryType::EfiBootServicesCode,
-        MemoryType::EfiBootServicesData,
-        MemoryType::EfiConventionalMemory,
+    // デスクトップ、コンソール、マウスカーソルはそれぞれ別のレイヤーに描き、LayerManagerが重ね合わせる
+    layer_manager = new(layer_manager_buf) LayerManager;
+    layer_manager->set_writer(pixel_writer);
+
+    const int DESKTOP_WIDTH = FRAME_WIDTH;
+    const int DESKTOP_HEIGHT = FRAME_HEIGHT;
+    // デスクトップの画像はヒープに置く。確保できなければレイヤーを作らず、画面を背景色で塗るだけにする
+    Window *desktop_window = nullptr;
+    auto desktop_window_mem = new(std::nothrow) uint32_t[DESKTOP_WIDTH * DESKTOP_HEIGHT];
+    if (desktop_window_mem) {
+        desktop_window = new(desktop_window_buf) Window{
+            desktop_window_mem, DESKTOP_WIDTH, DESKTOP_HEIGHT, frame_buffer_config
+        };
+        auto &desktop_writer = desktop_window->writer();
+        fill_rectangle(desktop_writer, {0, 0}, {DESKTOP_WIDTH, DESKTOP_HEIGHT - 50}, DESKTOP_BG_COLOR);
+        fill_rectangle(desktop_writer, {0, DESKTOP_HEIGHT - 50}, {DESKTOP_WIDTH, 50}, {1, 8, 17});
+        fill_rectangle(desktop_writer, {0, DESKTOP_HEIGHT - 50}, {DESKTOP_WIDTH / 5, 50}, {80, 80, 80});
+        draw_rectangle(desktop_writer, {10, DESKTOP_HEIGHT - 40}, {30, 30}, {160, 160, 160});
+    } else {
+        fill_rectangle(*pixel_writer, {0, 0}, {FRAME_WIDTH, FRAME_HEIGHT}, DESKTOP_BG_COLOR);
+    }
+
+    auto console_window = new(console_window_buf) Window{
+        console_window_mem, 8 * Console::COLUMNS, 16 * Console::ROWS, frame_buffer_config
     };
-    printk("memory_map: %p\n", &memory_map);
-    for (auto iter = reinterpret_cast<uintptr_t>(memory_map.buffer);
-         iter < reinterpret_cast<uintptr_t>(memory_map.buffer) + memory_map.buffer_size;
-         iter += memory_map.descriptor_size) {
-        auto desc = reinterpret_cast<MemoryDescriptor *>(iter);
-        for (const auto &available_memory_type: available_memory_types) {
-            if (desc->type == available_memory_type) {
-                printk("type = %u, phys = %08lx - %08lx, pages = %lu, attr = %08lx\n",
-                       desc->type,
-                       desc->physical_start,
-                       desc->physical_start + desc->number_of_pages * 4096 - 1,
-                       desc->number_of_pages,
-                       desc->attribute);
-            }
-        }
+    fill_rectangle(console_window->writer(), {0, 0}, {8 * Console::COLUMNS, 16 * Console::ROWS}, DESKTOP_BG_COLOR);
+
+    if (desktop_window) {
+        const auto desktop_layer = layer_manager->new_layer();
+        desktop_layer->set_window(desktop_window);
+        layer_manager->up_down(desktop_layer->id(), 0);
+    }
+    const auto console_layer = layer_manager->new_layer();
+    console_layer->set_window(console_window);
+    layer_manager->up_down(console_layer->id(), desktop_window ? 1 : 0);
+    layer_manager->draw({{0, 0}, {FRAME_WIDTH, FRAME_HEIGHT}});
+
+    console = new(console_buf) Console{console_window->writer(), DESKTOP_FG_COLOR, DESKTOP_BG_COLOR};
+    console->set_layer(layer_manager, console_layer->id());
+    printk("Welcom to MikanOS!\n");
+    if (!desktop_window) {
+        log(kError, "Failed to allocate the desktop window\n");
     }
 
+    // メモリマップを出力
+    print_memory_map(memory_map);
+
     // マウスカーソルのインスタンス生成
-    mouse_cursor = new(mouse_cursor_buf) MouseCursor{pixel_writer, DESKTOP_BG_COLOR, {300, 200}};
+    mouse_cursor = new(mouse_cursor_buf) MouseCursor{pixel_writer, {300, 200}};
+    layer_manager->set_sprite(mouse_cursor);
 
-    auto err = pci::scan_all_bus();
-    printk("scan_all_bus: %s\n", err.Name());
+    // 割り込みベクタを設定してIDTをCPUに登録
+    const uint16_t cs = GetCS();
+    set_IDT_entry(idt[InterruptVector::Serial], make_IDT_attr(DescriptorType::InterruptGate, 0),
+                  reinterpret_cast<uint64_t>(int_handler_serial), cs);
+    set_IDT_entry(idt[InterruptVector::LAPICTimer], make_IDT_attr(DescriptorType::InterruptGate, 0),
+                  reinterpret_cast<uint64_t>(int_handler_lapic_timer), cs);
+    set_IDT_entry(idt[InterruptVector::Wakeup], make_IDT_attr(DescriptorType::InterruptGate, 0),
+                  reinterpret_cast<uint64_t>(int_handler_wakeup), cs);
+    LoadIDT(sizeof(idt) - 1, reinterpret_cast<uintptr_t>(&idt[0]));
 
-    for (int i = 0; i < pci::num_devices; ++i) {
-        const auto &dev = pci::devices[i];
-        auto vendor_id = pci::read_vendor_id(dev);
-        auto class_code = pci::read_class_code(dev.bus, dev.device, dev.function);
-        printk("%d.%d.%d: vend %04x, class %08x, head %02x\n",
-               dev.bus, dev.device, dev.function,
-               vendor_id, class_code, dev.header_type);
+    // Local APICタイマーの周波数をPITで測り、ワンショットで動かし始める
+    timer_manager = new(timer_manager_buf) TimerManager;
+    timer_manager->initialize(InterruptVector::LAPICTimer);
+    event_dispatcher->set_handler(Message::Type::TimerTimeout, EventDispatcher::kNormal, on_timer);
+    log(kInfo, "Local APIC timer: %lu counts/s\n", timer_manager->frequency());
+
+    // 処理時間を測る時計を用意する
+    timing::initialize(*timer_manager);
+    // Local APICタイマーが止まらない範囲で、なるべく深いCステートで眠る
+    idle::initialize(IDLE_MAX_CSTATE);
+
+    // ここまでのコードをメインタスクとし、ほかのタスクと時分割で動かす
+    // どのタスクも動けなければアイドルタスクが眠る
+    // 割り込みハンドラが初期化の途中を見ないように、初期化を済ませてから公開する
+    auto new_task_manager = new(task_manager_buf) TaskManager;
+    new_task_manager->initialize(idle_until_work, nullptr);
+    task_manager = new_task_manager;
+
+    // フレームバッファを書き込み結合(WC)にして、ピクセルの書き込みをまとめて転送させる
+    // BOOT_BENCHMARKなら前後で画面全体を塗る速さを比べ、塗りつぶした画面は描き直す
+    uint64_t fill_rate_before = 0;
+    if constexpr (BOOT_BENCHMARK) {
+        fill_rate_before = measure_fill_rate(frame_buffer_config);
+    }
+    const size_t frame_buffer_size = 4 * static_cast<size_t>(frame_buffer_config.pixels_per_scan_line) *
+                                     frame_buffer_config.vertical_resolution;
+    if (auto err = paging::set_cache_mode(reinterpret_cast<uintptr_t>(frame_buffer_config.frame_buffer),
+                                          frame_buffer_size, paging::CacheMode::kWriteCombining)) {
+        log(kError, "Failed to map frame buffer as write-combining: %s\n", err.Name());
+    }
+    if constexpr (BOOT_BENCHMARK) {
+        const uint64_t fill_rate_after = measure_fill_rate(frame_buffer_config);
+        log(kInfo, "fill_rectangle: %lu Mpixel/s -> %lu Mpixel/s (write-combining)\n",
+            fill_rate_before, fill_rate_after);
+        const auto fill_paths = measure_fill_paths(frame_buffer_config);
+        log(kInfo, "fill: write() per pixel %lu Mpixel/s, fill_rect %lu Mpixel/s\n",
+            fill_paths.per_pixel, fill_paths.span);
+        layer_manager->draw({{0, 0}, {FRAME_WIDTH, FRAME_HEIGHT}});
+    }
+
+    Error err = MAKE_ERROR(Error::kSuccess);
+    {
+        ScopedTimer timer{scan_all_bus_latency};
+        err = pci::scan_all_bus();
+    }
+    printk("scan_all_bus: %s\n", err.Name());
+    print_pci_devices();
+    // xHCの初期化で止まっても、ここまでのログは画面に出しておく
+    flush_screen();
+
+    if constexpr (BOOT_BENCHMARK) {
+        const auto rates = measure_console_rates(memory_map);
+        log(kInfo, "console: %lu lines/s repainting on scroll -> %lu lines/s moving rows (%lu lines/s batched)\n",
+            rates.repaint, rates.per_line, rates.batched);
     }
 
     pci::Device *xhc_dev = nullptr;
@@ -165,32 +766,64 @@ extern "C" [[noreturn]] void KernelMainNewStack(const FrameBufferConfig &frame_b
         log(kError, "xHC has not been found\n");
     }
 
-    // 割り込みベクタを設定してIDTをCPUに登録
-    const uint16_t cs = GetCS();
-    set_IDT_entry(idt[InterruptVector::XHCI], make_IDT_attr(DescriptorType::InterruptGate, 0),
-                  reinterpret_cast<uint64_t>(int_handler_xhci), cs);
-    LoadIDT(sizeof(idt) - 1, reinterpret_cast<uintptr_t>(&idt[0]));
-    // MSI割り込みを有効化
-    // Destination ID(CPUコア番号)
-    // 0xfee00020番地の31:24ビットにプログラムが動作しているコアのLocal APCI IDを取得できる。
-    // 他のコアはまだ停止しているため、BSP(BootStrap Processor)のLocal APIC IDが得られる。
-    const uint8_t bsp_local_apic_id = *reinterpret_cast<const uint32_t *>(0xfee00020) >> 24;
-    pci::configure_msi_fixed_destination(*xhc_dev, bsp_local_apic_id, pci::MSITriggerMode::Level,
-                                         pci::MSIDeliveryMode::Fixed, InterruptVector::XHCI, 0);
+    // MSI-X(なければMSI)割り込みを有効化
+    // Destination ID(CPUコア番号)にはBSP(BootStrap Processor)のLocal APIC IDを指定する
+    // デバイスの割り込みはBSPのイベントループで処理する
+    const uint8_t bsp_local_apic_id = this_cpu().apic_id;
+    const auto xhc_vector = allocate_interrupt_vector(int_handler_xhci);
+    pci::MSIX xhc_msix{};
+    bool xhc_msix_enabled = false;
+    if (xhc_vector.error) {
+        log(kError, "Failed to allocate an interrupt vector for xHC: %s\n", xhc_vector.error.Name());
+    } else if (const auto msix = pci::enable_msix(*xhc_dev); !msix.error) {
+        // MSI-Xのエントリiはインタラプタiに対応する。エントリ0はドライバが持つプライマリのインタラプタ
+        log(kInfo, "xHC MSI-X: %u entries, vector 0x%02x\n", msix.value.num_entries, xhc_vector.value);
+        pci::configure_msix_entry(msix.value, 0, bsp_local_apic_id, pci::MSITriggerMode::Edge,
+                                  pci::MSIDeliveryMode::Fixed, xhc_vector.value);
+        xhc_msix = msix.value;
+        xhc_msix_enabled = true;
+    } else {
+        pci::configure_msi_fixed_destination(*xhc_dev, bsp_local_apic_id, pci::MSITriggerMode::Level,
+                                             pci::MSIDeliveryMode::Fixed, xhc_vector.value, 0);
+    }
+    // シリアルポートの割り込み(ISAのIRQ4)はI/O APIC経由でBSPに届ける
+    // IRQがI/O APICのどの入力につながっているかはMADTで上書きされていることがある
+    ioapic::disable_legacy_pic();
+    // 経路ができるまでに溜まったログは、経路を設定してから送り始める
+    // 受信した文字は入力として最優先で処理する
+    if (serial_port) {
+        event_dispatcher->set_handler(Message::Type::SerialReceived, EventDispatcher::kHigh, on_serial_received);
+        serial_port->set_receive_observer(serial_observer);
+        ioapic::route(acpi::irq_to_gsi(SerialPort::COM1_IRQ), InterruptVector::Serial, bsp_local_apic_id);
+        serial_port->start();
+    }
 
     const WithError<u_int64_t> xhc_bar = pci::read_bar(*xhc_dev, 0);
     log(kDebug, "ReadBar: %s\n", xhc_bar.error.Name());
     const uint64_t xhc_mmio_base = xhc_bar.value & ~static_cast<uint64_t>(0xf);
     log(kDebug, "xHC mmio_base: %08lx\n", xhc_mmio_base);
+    if (auto err = paging::set_cache_mode(xhc_mmio_base, XHC_MMIO_SIZE, paging::CacheMode::kUncacheable)) {
+        log(kError, "Failed to map xHC registers as uncacheable: %s\n", err.Name());
+    }
 
     usb::xhci::Controller xhc{xhc_mmio_base};
 
     if (0x8086 == pci::read_vendor_id(*xhc_dev)) {
         switch_ehci2xhci(*xhc_dev);
     } {
-        auto err = xhc.Initialize();
+        Error err = MAKE_ERROR(Error::kSuccess);
+        {
+            ScopedTimer timer{xhc_initialize_latency};
+            err = xhc.Initialize();
+        }
         log(kDebug, "xhc.Initialize: %s\n", err.Name());
     }
+    // セカンダリインタラプタはMSI-Xのときだけ使う。MSIではベクタを1つしか割り当てていない
+    if constexpr (XHC_SECONDARY_INTERRUPTERS > 0) {
+        if (xhc_msix_enabled) {
+            setup_xhc_secondary_interrupters(xhc_mmio_base, xhc_msix, bsp_local_apic_id);
+        }
+    }
 
     log(kInfo, "xHC starting\n");
     xhc.Run();
@@ -200,13 +833,22 @@ extern "C" [[noreturn]] void KernelMainNewStack(const FrameBufferConfig &frame_b
     // マウスのオブザーバーを設定
     usb::HIDMouseDriver::default_observer = mouse_observer;
 
+    // 入力は最優先で処理し、デバイスの通知がそれに続く
+    event_dispatcher->set_handler(Message::Type::MouseMove, EventDispatcher::kHigh, on_mouse_move);
+    event_dispatcher->set_handler(Message::Type::InterruptXHCI, EventDispatcher::kNormal, on_xhci_event);
+
     // USBを調べて接続済みポートの設定を行う。
     for (int i = 1; i <= xhc.MaxPorts(); ++i) {
         auto port = xhc.PortAt(i);
         log(kDebug, "Port %d: IsConnected=%d\n", i, port.IsConnected());
 
         if (port.IsConnected()) {
-            if (auto err = usb::xhci::ConfigurePort(xhc, port)) {
+            Error err = MAKE_ERROR(Error::kSuccess);
+            {
+                ScopedTimer timer{configure_port_latency};
+                err = usb::xhci::ConfigurePort(xhc, port);
+            }
+            if (err) {
                 log(kError, "Failed to configure port: %s at %s:%d\n",
                     err.Name(), err.File(), err.Line());
                 continue;
@@ -214,39 +856,51 @@ extern "C" [[noreturn]] void KernelMainNewStack(const FrameBufferConfig &frame_b
         }
     }
 
-    // キューを作成
-    std::array<Message, 32> main_queue_data{};
-    ArrayQueue main_queue{main_queue_data};
-    ::main_queue = &main_queue;
+    // APを起動し、それぞれのコアで自分のイベントループを回す
+    // ページテーブルのキャッシュの設定はAPのTLBに伝わらないので、設定をすべて済ませてから起動する
+    if (auto err = cpu::start_application_processors(memory_map)) {
+        log(kError, "Failed to start application processors: %s\n", err.Name());
+    }
+    {
+        const uint64_t serial_ns = measure_fan_out(false);
+        const uint64_t parallel_ns = measure_fan_out(true);
+        const uint64_t speedup = parallel_ns ? serial_ns * 100 / parallel_ns : 0;
+        log(kInfo, "fan-out: %d items, 1 core %lu us, %d cores %lu us (x%lu.%02lu)\n",
+            FAN_OUT_ITEMS, serial_ns / 1000, cpu::count(), parallel_ns / 1000, speedup / 100, speedup % 100);
+    }
+    {
+        const auto cost = measure_context_switch();
+        log(kInfo, "context switch: %lu ns, %lu cycles (%lu switches/s)\n",
+            cost.ns, cost.cycles, cost.ns ? 1'000'000'000 / cost.ns : 0);
+    }
+
+    scan_all_bus_latency.report("pci::scan_all_bus");
+    xhc_initialize_latency.report("xhc.Initialize");
+    configure_port_latency.report("ConfigurePort");
+
+    // コンソールの描画時間、アイドル時間、ヒープの使用量は定期的にデバッグログへ出す
+    Timer latency_report_timer{report_latency};
+    timer_manager->arm(latency_report_timer, LATENCY_REPORT_INTERVAL_MS);
+
     // 割り込みのイベントループ
     while (true) {
-        // 割り込みフラグ(IF)をクリアして割り込みを無効化
-        // キューの操作中に割り込みが起きるとデータの整合性が損なわれるため
-        __asm__("cli");
-        // キューにメッセージが入ってないなら次の割り込みまで待つ
-        if (main_queue.count() == 0) {
-            // stiで割り込みを有効化して、hltで割り込みを待機
-            __asm__("sti\n\thlt");
+        // 前回の処理で出力したログや描画した内容をまとめて画面に反映する
+        // printkやlogは文字列をコンソールに書き込むだけなので、イベント処理が描画を待たされることはない
+        flush_screen();
+
+        // 仕事が来るまでメインタスクを止める。ほかのタスクがなければアイドルタスクがMWAITかhltで眠る
+        // 確かめてから止めるまでに割り込みで起こされないように、割り込みを禁止しておく
+        const auto rflags = save_and_disable_interrupts();
+        const bool has_work = event_dispatcher->has_work();
+        if (!has_work) {
+            task_manager->sleep();
+        }
+        restore_interrupts(rflags);
+        if (!has_work) {
             continue;
         }
 
-        // キューからメッセージを取り出す
-        auto msg = main_queue.front();
-        main_queue.pop();
-        // 割り込みフラグ(IF)を再度有効化
-        __asm__("sti");
-
-        switch (msg.type) {
-            case Message::Type::InterruptXHCI:
-                while (xhc.PrimaryEventRing()->HasFront()) {
-                    if (auto err = usb::xhci::ProcessEvent(xhc)) {
-                        log(kError, "Error while ProcessingEvent: %s at %s:%d\n",
-                            err.Name(), err.File(), err.Line());
-                    }
-                }
-                break;
-            default:
-                log(kError, "Unknown message type: %d\n", static_cast<int>(msg.type));
-        }
+        // 起床1回で、準備のできている発生源をすべて優先度順に処理する
+        event_dispatcher->dispatch();
     }
 }
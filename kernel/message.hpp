@@ -0,0 +1,47 @@
+#ifndef MESSAGE_HPP
+#define MESSAGE_HPP
+
+#include <cstdint>
+
+struct Message
+{
+    enum class Type
+    {
+        // xHCにイベントがある（何回通知されても1回処理すればよい）
+        InterruptXHCI,
+        // マウスが動いた（移動量はまとめて保持されている）
+        MouseMove,
+        KeyPush,
+        TimerTimeout,
+        SerialReceived,
+        // ワークキューに仕事がある（何回通知されても1回処理すればよい）
+        WorkAvailable,
+        // xHCのセカンダリインタラプタのイベントリングにイベントがある（何回通知されても1回処理すればよい）
+        InterruptXHCISecondary,
+        // この列挙子は常に最後に配置する
+        kLastOfType,
+    } type;
+
+    union
+    {
+        struct
+        {
+            uint8_t modifier;
+            uint8_t keycode;
+            char ascii;
+        } keyboard;
+
+        struct
+        {
+            uint64_t timeout;
+            int value;
+        } timer;
+
+        struct
+        {
+            char c;
+        } serial;
+    } arg;
+};
+
+#endif //MESSAGE_HPP
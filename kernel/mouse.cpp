@@ -1,9 +1,10 @@
 #include "mouse.hpp"
 
+#include <algorithm>
+#include <array>
+
 namespace
 {
-    constexpr int MOUSE_CURSOR_WIDTH = 15;
-    constexpr int MOUSE_CURSOR_HEIGHT = 24;
     constexpr char MOUSE_CURSOR_SHAPE[MOUSE_CURSOR_HEIGHT][MOUSE_CURSOR_WIDTH + 1] = {
         "@              ",
         "@@             ",
@@ -31,50 +32,162 @@ namespace
         "         @@@   ",
     };
 
-    void draw_mouse_cursor(PixelWriter* pixel_writer, const Vector2D<int> position)
+    constexpr int MAX_SPANS_PER_ROW = 3;
+
+    struct CursorSpan
     {
+        int start, width;
+    };
+
+    struct CursorRow
+    {
+        // 保存・復元する範囲 [0, extent)
+        int extent;
+        int num_spans;
+        CursorSpan spans[MAX_SPANS_PER_ROW];
+    };
+
+    // MOUSE_CURSOR_SHAPE の各行を不透明な（空白でない）スパンに分解する
+    constexpr std::array<CursorRow, MOUSE_CURSOR_HEIGHT> make_cursor_rows()
+    {
+        std::array<CursorRow, MOUSE_CURSOR_HEIGHT> rows{};
         for (int dy = 0; dy < MOUSE_CURSOR_HEIGHT; ++dy)
         {
-            for (int dx = 0; dx < MOUSE_CURSOR_WIDTH; ++dx)
+            auto& row = rows[dy];
+            int dx = 0;
+            while (dx < MOUSE_CURSOR_WIDTH)
             {
-                if (MOUSE_CURSOR_SHAPE[dy][dx] == '@')
+                if (MOUSE_CURSOR_SHAPE[dy][dx] == ' ')
+                {
+                    ++dx;
+                    continue;
+                }
+                const int start = dx;
+                while (dx < MOUSE_CURSOR_WIDTH && MOUSE_CURSOR_SHAPE[dy][dx] != ' ')
                 {
-                    pixel_writer->write(position.x + dx, position.y + dy, {0, 0, 0});
+                    ++dx;
                 }
-                else if (MOUSE_CURSOR_SHAPE[dy][dx] == '.')
+                if (row.num_spans < MAX_SPANS_PER_ROW)
                 {
-                    pixel_writer->write(position.x + dx, position.y + dy, {255, 255, 255});
+                    row.spans[row.num_spans] = {start, dx - start};
                 }
+                ++row.num_spans;
+                row.extent = dx;
             }
         }
+        return rows;
     }
 
-    void erase_mouse_cursor(PixelWriter* pixel_writer, const Vector2D<int> position, const PixelColor erase_color)
+    constexpr auto CURSOR_ROWS = make_cursor_rows();
+
+    constexpr bool spans_fit()
     {
-        for (int dy = 0; dy < MOUSE_CURSOR_HEIGHT; ++dy)
+        for (const auto& row : CURSOR_ROWS)
         {
-            for (int dx = 0; dx < MOUSE_CURSOR_WIDTH; ++dx)
+            if (row.num_spans > MAX_SPANS_PER_ROW)
             {
-                if (MOUSE_CURSOR_SHAPE[dy][dx] != ' ')
-                {
-                    pixel_writer->write(position.x + dx, position.y + dy, erase_color);
-                }
+                return false;
             }
         }
+        return true;
     }
+
+    static_assert(spans_fit(), "increase MAX_SPANS_PER_ROW");
+
+    constexpr Rectangle<int> CURSOR_AREA{{0, 0}, {MOUSE_CURSOR_WIDTH, MOUSE_CURSOR_HEIGHT}};
 }
 
-MouseCursor::MouseCursor(PixelWriter* writer, const PixelColor erase_color, const Vector2D<int> initial_position)
+MouseCursor::MouseCursor(PixelWriter* writer, const Vector2D<int> initial_position)
     : pixel_writer(writer),
-      erase_color(erase_color),
-      position(initial_position)
+      position(initial_position),
+      pixels{},
+      saved{}
 {
-    draw_mouse_cursor(pixel_writer, position);
+    const uint32_t black = pixel_writer->to_pixel({0, 0, 0});
+    const uint32_t white = pixel_writer->to_pixel({255, 255, 255});
+    for (int dy = 0; dy < MOUSE_CURSOR_HEIGHT; ++dy)
+    {
+        for (int dx = 0; dx < MOUSE_CURSOR_WIDTH; ++dx)
+        {
+            pixels[dy][dx] = MOUSE_CURSOR_SHAPE[dy][dx] == '.' ? white : black;
+        }
+    }
+
+    save_under(CURSOR_AREA);
+    draw(CURSOR_AREA);
 }
 
 void MouseCursor::move_relative(const Vector2D<int> displacement)
 {
-    erase_mouse_cursor(pixel_writer, position, erase_color);
+    restore_under();
+
     position += displacement;
-    draw_mouse_cursor(pixel_writer, position);
+    // カーソルの先端は画面内に留める
+    position.x = std::clamp(position.x, 0, pixel_writer->width() - 1);
+    position.y = std::clamp(position.y, 0, pixel_writer->height() - 1);
+
+    save_under(CURSOR_AREA);
+    draw(CURSOR_AREA);
+}
+
+void MouseCursor::on_redrawn(PixelWriter& writer, const Rectangle<int>& area)
+{
+    // 描き直された部分ではカーソルが消え，その下の内容も新しくなっている
+    const Rectangle<int> cursor_rect{position, {MOUSE_CURSOR_WIDTH, MOUSE_CURSOR_HEIGHT}};
+    const auto overlap = area & cursor_rect;
+    if (overlap.empty())
+    {
+        return;
+    }
+    // 描き直されていない行の下にはカーソルが描かれたままなので，保存し直してはならない
+    const Rectangle<int> redrawn{{overlap.pos.x - position.x, overlap.pos.y - position.y}, overlap.size};
+    save_under(redrawn);
+    draw(redrawn);
+}
+
+// カーソルのうち area の範囲の下を保存する
+void MouseCursor::save_under(const Rectangle<int>& area)
+{
+    const int left = area.pos.x;
+    const int right = area.right();
+    for (int dy = area.pos.y; dy < area.bottom(); ++dy)
+    {
+        const int end = std::min(CURSOR_ROWS[dy].extent, right);
+        if (left < end)
+        {
+            pixel_writer->read_row(position.x + left, position.y + dy, &saved[dy][left], end - left);
+        }
+    }
+}
+
+// カーソルのうち area の範囲にあるスパンを描く
+void MouseCursor::draw(const Rectangle<int>& area)
+{
+    const int left = area.pos.x;
+    const int right = area.right();
+    for (int dy = area.pos.y; dy < area.bottom(); ++dy)
+    {
+        const auto& row = CURSOR_ROWS[dy];
+        for (int i = 0; i < row.num_spans; ++i)
+        {
+            const int start = std::max(row.spans[i].start, left);
+            const int end = std::min(row.spans[i].start + row.spans[i].width, right);
+            if (start < end)
+            {
+                pixel_writer->write_row(position.x + start, position.y + dy, &pixels[dy][start], end - start);
+            }
+        }
+    }
+}
+
+void MouseCursor::restore_under()
+{
+    for (int dy = 0; dy < MOUSE_CURSOR_HEIGHT; ++dy)
+    {
+        const int extent = CURSOR_ROWS[dy].extent;
+        if (extent > 0)
+        {
+            pixel_writer->write_row(position.x, position.y + dy, saved[dy], extent);
+        }
+    }
 }
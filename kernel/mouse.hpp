@@ -1,18 +1,46 @@
 #ifndef MOUSE_HPP
 #define MOUSE_HPP
 #include "graphics.hpp"
+#include "layer.hpp"
 
+constexpr int MOUSE_CURSOR_WIDTH = 15;
+constexpr int MOUSE_CURSOR_HEIGHT = 24;
 
-class MouseCursor
+/**
+ * 画面に直接描くマウスカーソル．
+ *
+ * カーソルの下にあったピクセルを保存しておき，移動するときはそれを書き戻してから
+ * 新しい位置の下を保存して描く．カーソルの形は行毎の不透明なスパンとしてコンパイル時に求めてあり，
+ * 色も生成時に画面のピクセル形式に変換しておくので，1回の移動は行単位のコピー数回で済む．
+ */
+class MouseCursor final : public Sprite
 {
 public:
-    MouseCursor(PixelWriter* writer, PixelColor erase_color, Vector2D<int> initial_position);
+    MouseCursor(PixelWriter* writer, Vector2D<int> initial_position);
     void move_relative(Vector2D<int> displacement);
+    void on_redrawn(PixelWriter& writer, const Rectangle<int>& area) override;
+
+    void* operator new(size_t size, void* buf)
+    {
+        return buf;
+    }
+
+    void operator delete(void* obj) noexcept
+    {
+    }
 
 private:
+    // area はカーソルの左上を原点とする範囲
+    void save_under(const Rectangle<int>& area);
+    void draw(const Rectangle<int>& area);
+    void restore_under();
+
     PixelWriter* pixel_writer;
-    PixelColor erase_color;
     Vector2D<int> position;
+    // 画面のピクセル形式に変換済みのカーソルの画像
+    uint32_t pixels[MOUSE_CURSOR_HEIGHT][MOUSE_CURSOR_WIDTH];
+    // カーソルの下にあったピクセル
+    uint32_t saved[MOUSE_CURSOR_HEIGHT][MOUSE_CURSOR_WIDTH];
 };
 
 
@@ -7,10 +7,20 @@ void _exit(void)
     while (1) __asm__("hlt");
 }
 
+// malloc が使う領域．heap::initialize で設定される
+caddr_t program_break, program_break_end;
+
 caddr_t sbrk(int incr)
 {
-    errno = ENOMEM;
-    return (caddr_t)-1;
+    if (program_break == 0 || program_break + incr > program_break_end)
+    {
+        errno = ENOMEM;
+        return (caddr_t)-1;
+    }
+
+    caddr_t prev_break = program_break;
+    program_break += incr;
+    return prev_break;
 }
 
 int getpid(void)
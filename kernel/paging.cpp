@@ -0,0 +1,230 @@
+#include "paging.hpp"
+
+#include <array>
+#include <cpuid.h>
+
+#include "asmfunc.hpp"
+
+namespace
+{
+    constexpr uint64_t PRESENT = 1u << 0;
+    constexpr uint64_t WRITABLE = 1u << 1;
+    constexpr uint64_t WRITE_THROUGH = 1u << 3; // PWT
+    constexpr uint64_t CACHE_DISABLE = 1u << 4; // PCD
+    constexpr uint64_t HUGE_PAGE = 1u << 7; // PS
+    // PAT ビットは 4KiB ページではビット7，大きなページではビット12にある
+    constexpr uint64_t PAGE_PAT = 1u << 7;
+    constexpr uint64_t HUGE_PAGE_PAT = 1u << 12;
+    constexpr uint64_t ADDRESS_MASK = 0x000ffffffffff000;
+
+    constexpr size_t ENTRIES = 512;
+    constexpr uint64_t PAGE_SIZE_4K = 4096;
+    // 2MiB ページでマップするときの範囲（GiB）．1GiB ページを分割するときにもここから取る
+    constexpr size_t PAGE_DIRECTORY_COUNT = 64;
+    // 2MiB ページを 4KiB ページに分割するためのページテーブルの数
+    constexpr size_t PAGE_TABLE_COUNT = 16;
+
+    /**
+     * PAT の各エントリ．PWT, PCD, PAT ビットの組がインデックスになる．
+     * インデックス1を既定の WT から WC に変え，それ以外は既定のままにする．
+     * したがって UEFI が作ったページテーブルや PWT を使わない既存のエントリの意味は変わらない．
+     */
+    constexpr uint32_t IA32_PAT = 0x277;
+    constexpr uint64_t PAT_UC = 0x00, PAT_WC = 0x01, PAT_WT = 0x04, PAT_WB = 0x06, PAT_UC_MINUS = 0x07;
+    constexpr uint64_t PAT_VALUE =
+        PAT_WB | PAT_WC << 8 | PAT_UC_MINUS << 16 | PAT_UC << 24 |
+        PAT_WB << 32 | PAT_WT << 40 | PAT_UC_MINUS << 48 | PAT_UC << 56;
+
+    using PageTable = std::array<uint64_t, ENTRIES>;
+
+    alignas(4096) PageTable pml4_table;
+    alignas(4096) PageTable pdp_table;
+    alignas(4096) std::array<PageTable, PAGE_DIRECTORY_COUNT> page_directories;
+    alignas(4096) std::array<PageTable, PAGE_TABLE_COUNT> page_tables;
+    size_t used_page_directories = 0;
+    size_t used_page_tables = 0;
+    bool gib_pages = false;
+    bool pat_supported = false;
+
+    bool supports_1g_pages()
+    {
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid_max(0x80000000, nullptr) < 0x80000001)
+        {
+            return false;
+        }
+        __cpuid(0x80000001, eax, ebx, ecx, edx);
+        return edx & (1u << 26);
+    }
+
+    bool supports_pat()
+    {
+        unsigned int eax, ebx, ecx, edx;
+        __cpuid(1, eax, ebx, ecx, edx);
+        return edx & (1u << 16);
+    }
+
+    // mode を表す PWT, PCD の組．PAT ビットは常に0でよい（インデックス0〜3で足りる）
+    uint64_t cache_bits(const paging::CacheMode mode)
+    {
+        switch (mode)
+        {
+        case paging::CacheMode::kWriteBack:
+            return 0;
+        case paging::CacheMode::kWriteCombining:
+            return WRITE_THROUGH;
+        case paging::CacheMode::kUncacheable:
+            return CACHE_DISABLE | WRITE_THROUGH;
+        }
+        return 0;
+    }
+
+    // addr を含む 2MiB ページのエントリを返す．1GiB ページなら分割する
+    uint64_t* page_directory_entry(const uintptr_t addr)
+    {
+        const size_t pdp_index = addr / paging::PAGE_SIZE_1G;
+        const size_t pd_index = addr / paging::PAGE_SIZE_2M % ENTRIES;
+        if (pdp_index >= ENTRIES || (pdp_table[pdp_index] & PRESENT) == 0)
+        {
+            return nullptr;
+        }
+
+        if (pdp_table[pdp_index] & HUGE_PAGE)
+        {
+            if (used_page_directories == PAGE_DIRECTORY_COUNT)
+            {
+                return nullptr;
+            }
+            // 属性はそのままに，同じ範囲を 2MiB ページ512個で表す
+            auto& directory = page_directories[used_page_directories++];
+            const uint64_t entry = pdp_table[pdp_index];
+            for (size_t i = 0; i < ENTRIES; ++i)
+            {
+                directory[i] = (entry & ~ADDRESS_MASK) | ((entry & ADDRESS_MASK) + i * paging::PAGE_SIZE_2M);
+            }
+            pdp_table[pdp_index] = reinterpret_cast<uint64_t>(&directory[0]) | PRESENT | WRITABLE;
+        }
+
+        const auto directory = reinterpret_cast<uint64_t*>(pdp_table[pdp_index] & ADDRESS_MASK);
+        return &directory[pd_index];
+    }
+
+    // addr を含む 4KiB ページのエントリを返す．2MiB ページなら分割する
+    uint64_t* page_table_entry(const uintptr_t addr)
+    {
+        uint64_t* pde = page_directory_entry(addr);
+        if (pde == nullptr)
+        {
+            return nullptr;
+        }
+
+        if (*pde & HUGE_PAGE)
+        {
+            if (used_page_tables == PAGE_TABLE_COUNT)
+            {
+                return nullptr;
+            }
+            auto& table = page_tables[used_page_tables++];
+            const uint64_t entry = *pde;
+            uint64_t flags = entry & ~ADDRESS_MASK & ~HUGE_PAGE & ~HUGE_PAGE_PAT;
+            if (entry & HUGE_PAGE_PAT)
+            {
+                flags |= PAGE_PAT;
+            }
+            for (size_t i = 0; i < ENTRIES; ++i)
+            {
+                table[i] = flags | ((entry & ADDRESS_MASK & ~(paging::PAGE_SIZE_2M - 1)) + i * PAGE_SIZE_4K);
+            }
+            *pde = reinterpret_cast<uint64_t>(&table[0]) | PRESENT | WRITABLE;
+        }
+
+        const auto table = reinterpret_cast<uint64_t*>(*pde & ADDRESS_MASK);
+        return &table[addr / PAGE_SIZE_4K % ENTRIES];
+    }
+}
+
+namespace paging
+{
+    void setup_identity_page_table()
+    {
+        // 新しいページテーブルを読み込む前に PAT を書き換えておけば，切り替え時の TLB の破棄で古い解釈が残らない
+        pat_supported = supports_pat();
+        if (pat_supported)
+        {
+            WriteMSR(IA32_PAT, PAT_VALUE);
+        }
+
+        gib_pages = supports_1g_pages();
+        pml4_table[0] = reinterpret_cast<uint64_t>(&pdp_table[0]) | PRESENT | WRITABLE;
+
+        if (gib_pages)
+        {
+            for (size_t i = 0; i < ENTRIES; ++i)
+            {
+                pdp_table[i] = (i * PAGE_SIZE_1G) | PRESENT | WRITABLE | HUGE_PAGE;
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < PAGE_DIRECTORY_COUNT; ++i)
+            {
+                pdp_table[i] = reinterpret_cast<uint64_t>(&page_directories[i][0]) | PRESENT | WRITABLE;
+                for (size_t j = 0; j < ENTRIES; ++j)
+                {
+                    page_directories[i][j] = (i * PAGE_SIZE_1G + j * PAGE_SIZE_2M) | PRESENT | WRITABLE | HUGE_PAGE;
+                }
+            }
+            used_page_directories = PAGE_DIRECTORY_COUNT;
+        }
+
+        SetCR3(reinterpret_cast<uint64_t>(&pml4_table[0]));
+    }
+
+    void setup_application_processor()
+    {
+        if (pat_supported)
+        {
+            WriteMSR(IA32_PAT, PAT_VALUE);
+        }
+        SetCR3(GetCR3());
+    }
+
+    bool uses_1g_pages()
+    {
+        return gib_pages;
+    }
+
+    Error set_cache_mode(const uintptr_t start, const size_t size, const CacheMode mode)
+    {
+        if (mode == CacheMode::kWriteCombining && !pat_supported)
+        {
+            return MAKE_ERROR(Error::kNotImplemented);
+        }
+
+        const uintptr_t end = start + size;
+        uintptr_t addr = start & ~(PAGE_SIZE_4K - 1);
+        while (addr < end)
+        {
+            // 2MiB ページ全体が範囲に入るならそのまま，端にかかるなら 4KiB ページに分けて設定する
+            uint64_t* pde = page_directory_entry(addr);
+            if (pde && (*pde & HUGE_PAGE) && addr % PAGE_SIZE_2M == 0 && addr + PAGE_SIZE_2M <= end)
+            {
+                *pde = (*pde & ~(WRITE_THROUGH | CACHE_DISABLE | HUGE_PAGE_PAT)) | cache_bits(mode);
+                addr += PAGE_SIZE_2M;
+                continue;
+            }
+
+            uint64_t* pte = page_table_entry(addr);
+            if (pte == nullptr)
+            {
+                return MAKE_ERROR(Error::kIndexOutOfRange);
+            }
+            *pte = (*pte & ~(WRITE_THROUGH | CACHE_DISABLE | PAGE_PAT)) | cache_bits(mode);
+            addr += PAGE_SIZE_4K;
+        }
+
+        // 変更したエントリが TLB に残らないよう，CR3 を設定し直してすべて捨てる
+        SetCR3(GetCR3());
+        return MAKE_ERROR(Error::kSuccess);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef PAGING_HPP
+#define PAGING_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+
+/**
+ * @file paging.hpp
+ *
+ * カーネル自身のページテーブルを構築し，領域毎のキャッシュの扱いを設定する．
+ */
+
+namespace paging
+{
+    constexpr uint64_t PAGE_SIZE_2M = 2 * 1024 * 1024;
+    constexpr uint64_t PAGE_SIZE_1G = 1024 * PAGE_SIZE_2M;
+
+    enum class CacheMode
+    {
+        kWriteBack,
+        // 書き込みをまとめてバースト転送する．読み出しはキャッシュされない．フレームバッファ向け
+        kWriteCombining,
+        kUncacheable,
+    };
+
+    /**
+     * 物理アドレスと仮想アドレスが一致するページテーブルを作り，CR3 に設定する．
+     * CPU が PAT に対応していれば，PAT のエントリ1を WC にする．
+     * CPU が対応していれば 1GiB ページで 512GiB を，そうでなければ 2MiB ページで 64GiB をマップする．
+     * 大きなページを使うので，全メモリをなめる処理でも TLB ミスがほとんど起きない．
+     */
+    void setup_identity_page_table();
+
+    /**
+     * AP で，BSP と同じ PAT を設定してページテーブルを読み込み直す．
+     * PAT はコア毎の MSR なので，書き換えないと AP からは WC の領域が WT に見えてしまう．
+     */
+    void setup_application_processor();
+
+    [[nodiscard]] bool uses_1g_pages();
+
+    /**
+     * [start, start + size) のキャッシュの扱いを mode にする．MMIO 領域はキャッシュ不可にしなければならない．
+     * 範囲に収まる 2MiB ページはそのまま設定し，端にかかるページは 4KiB ページに分割して
+     * 範囲の外の扱いを変えない．
+     * 自分のコアの TLB しか破棄しないので，AP を起動する前に設定を済ませておく．
+     */
+    Error set_cache_mode(uintptr_t start, size_t size, CacheMode mode);
+}
+
+#endif //PAGING_HPP
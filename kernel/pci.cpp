@@ -1,5 +1,6 @@
 #include "pci.hpp"
 #include "asmfunc.hpp"
+#include "paging.hpp"
 
 namespace
 {
@@ -165,10 +166,79 @@ namespace
     return MAKE_ERROR(Error::kSuccess);
   }
 
+  // MSI-Xテーブルのエントリに書き込む．書き換えの途中で割り込みが届かないよう，マスクしたまま書く
+  void write_MSIX_entry(const MSIX& msix, const unsigned int index, const uint64_t msg_addr, const uint32_t msg_data)
+  {
+    auto& entry = msix.table[index];
+    entry.vector_control = entry.vector_control | 1u;
+    entry.msg_addr = msg_addr & 0xffffffffu;
+    entry.msg_upper_addr = msg_addr >> 32;
+    entry.msg_data = msg_data;
+    entry.vector_control = entry.vector_control & ~1u;
+  }
+
   Error configure_MSIX_register(const Device& dev, uint8_t cap_addr, uint32_t msg_addr, uint32_t msg_data,
                                 unsigned int num_vector_exponent)
   {
-    return MAKE_ERROR(Error::kNotImplemented);
+    auto [msix, err] = enable_msix(dev);
+    if (err)
+    {
+      return err;
+    }
+
+    // MSIと同様に，全エントリへ同じメッセージを設定する
+    const unsigned int num_vectors = 1u << num_vector_exponent;
+    for (unsigned int i = 0; i < num_vectors && i < msix.num_entries; ++i)
+    {
+      write_MSIX_entry(msix, i, msg_addr, msg_data);
+    }
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  uint8_t find_capability(const Device& dev, const uint8_t cap_id)
+  {
+    uint8_t cap_addr = read_conf_reg(dev, 0x34) & 0xffu;
+    while (cap_addr != 0)
+    {
+      const auto header = read_capability_header(dev, cap_addr);
+      if (header.bits.cap_id == cap_id)
+      {
+        return cap_addr;
+      }
+      cap_addr = header.bits.next_ptr;
+    }
+    return 0;
+  }
+
+  uint32_t make_msg_addr(const uint8_t apic_id)
+  {
+    return 0xfee00000u | (apic_id << 12);
+  }
+
+  uint32_t make_msg_data(const MSITriggerMode trigger_mode, const MSIDeliveryMode delivery_mode, const uint8_t vector)
+  {
+    uint32_t msg_data = (static_cast<uint32_t>(delivery_mode) << 8) | vector;
+    if (trigger_mode == MSITriggerMode::Level)
+    {
+      msg_data |= 0xc000;
+    }
+    return msg_data;
+  }
+
+  // BIRとオフセットを組み合わせたレジスタの値から，指す領域の物理アドレスを求める
+  WithError<uint64_t> read_MSIX_region(Device dev, const uint32_t bir_offset)
+  {
+    auto [bar, err] = read_bar(dev, bir_offset & 0x7u);
+    if (err)
+    {
+      return {0, err};
+    }
+    // I/O空間のBARにはテーブルを置けない
+    if (bar & 1u)
+    {
+      return {0, MAKE_ERROR(Error::kInvalidArgument)};
+    }
+    return {(bar & ~static_cast<uint64_t>(0xf)) + (bir_offset & ~0x7u), MAKE_ERROR(Error::kSuccess)};
   }
 }
 
@@ -337,13 +407,99 @@ namespace pci
                                         MSIDeliveryMode delivery_mode, const uint8_t vector,
                                         const unsigned int num_vector_exponent)
   {
-    const uint32_t msg_addr = 0xfee00000u | (apic_id << 12);
-    uint32_t msg_data = (static_cast<uint32_t>(delivery_mode) << 8) | vector;
-    if (trigger_mode == MSITriggerMode::Level)
+    return configure_msi(dev, make_msg_addr(apic_id), make_msg_data(trigger_mode, delivery_mode, vector),
+                         num_vector_exponent);
+  }
+
+  WithError<MSIX> enable_msix(const Device& dev)
+  {
+    const uint8_t cap_addr = find_capability(dev, CAPABILITY_MSIX);
+    if (cap_addr == 0)
     {
-      msg_data |= 0xc000;
+      return {{}, MAKE_ERROR(Error::kNoPCIMSI)};
+    }
+
+    MSIXCapability cap{};
+    cap.header.data = read_conf_reg(dev, cap_addr);
+    cap.table = read_conf_reg(dev, cap_addr + 4);
+    cap.pba = read_conf_reg(dev, cap_addr + 8);
+
+    MSIX msix{};
+    msix.num_entries = cap.header.bits.table_size + 1;
+
+    const auto table = read_MSIX_region(dev, cap.table);
+    if (table.error)
+    {
+      return {{}, table.error};
+    }
+    const auto pba = read_MSIX_region(dev, cap.pba);
+    if (pba.error)
+    {
+      return {{}, pba.error};
+    }
+    // テーブルとPBAへの読み書きはそのままデバイスに届かなければならない
+    const size_t table_size = msix.num_entries * sizeof(MSIXTableEntry);
+    const size_t pba_size = (msix.num_entries + 63) / 64 * sizeof(uint64_t);
+    if (auto err = paging::set_cache_mode(table.value, table_size, paging::CacheMode::kUncacheable))
+    {
+      return {{}, err};
+    }
+    if (auto err = paging::set_cache_mode(pba.value, pba_size, paging::CacheMode::kUncacheable))
+    {
+      return {{}, err};
+    }
+    msix.table = reinterpret_cast<volatile MSIXTableEntry*>(table.value);
+    msix.pba = reinterpret_cast<volatile uint64_t*>(pba.value);
+
+    // MSIとMSI-Xを同時に有効にしてはならない．INTxも止める
+    if (const uint8_t msi_cap_addr = find_capability(dev, CAPABILITY_MSI))
+    {
+      auto msi_header = read_capability_header(dev, msi_cap_addr);
+      msi_header.data &= ~(1u << 16);
+      write_conf_reg(dev, msi_cap_addr, msi_header.data);
     }
-    return configure_msi(dev, msg_addr, msg_data, num_vector_exponent);
+    write_conf_reg(dev, 0x04, (read_conf_reg(dev, 0x04) & 0xffffu) | (1u << 10));
+
+    // 機能全体をマスクしたまま有効にし，全エントリをマスクしてから機能のマスクを外す
+    cap.header.bits.msix_enable = 1;
+    cap.header.bits.function_mask = 1;
+    write_conf_reg(dev, cap_addr, cap.header.data);
+    for (unsigned int i = 0; i < msix.num_entries; ++i)
+    {
+      msix.table[i].vector_control = msix.table[i].vector_control | 1u;
+    }
+    cap.header.bits.function_mask = 0;
+    write_conf_reg(dev, cap_addr, cap.header.data);
+
+    return {msix, MAKE_ERROR(Error::kSuccess)};
+  }
+
+  Error configure_msix_entry(const MSIX& msix, const unsigned int index, const uint8_t apic_id,
+                             const MSITriggerMode trigger_mode, const MSIDeliveryMode delivery_mode,
+                             const uint8_t vector)
+  {
+    if (index >= msix.num_entries)
+    {
+      return MAKE_ERROR(Error::kIndexOutOfRange);
+    }
+    write_MSIX_entry(msix, index, make_msg_addr(apic_id), make_msg_data(trigger_mode, delivery_mode, vector));
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  Error mask_msix_entry(const MSIX& msix, const unsigned int index, const bool masked)
+  {
+    if (index >= msix.num_entries)
+    {
+      return MAKE_ERROR(Error::kIndexOutOfRange);
+    }
+    auto& entry = msix.table[index];
+    entry.vector_control = masked ? entry.vector_control | 1u : entry.vector_control & ~1u;
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  bool msix_pending(const MSIX& msix, const unsigned int index)
+  {
+    return index < msix.num_entries && (msix.pba[index / 64] >> (index % 64) & 1u);
   }
 }
 
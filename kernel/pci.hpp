@@ -141,6 +141,65 @@ namespace pci
                                           MSIDeliveryMode delivery_mode,
                                           uint8_t vector,
                                           unsigned int num_vector_exponent);
+
+    // MSI-Xケーパビリティ構造
+    struct MSIXCapability
+    {
+        union
+        {
+            uint32_t data;
+
+            struct
+            {
+                uint32_t cap_id : 8;
+                uint32_t next_ptr : 8;
+                // テーブルのエントリ数 - 1
+                uint32_t table_size : 11;
+                uint32_t : 3;
+                uint32_t function_mask : 1;
+                uint32_t msix_enable : 1;
+            } __attribute__((packed)) bits;
+        } __attribute__((packed)) header;
+
+        // 下位3ビットがBARの番号(BIR)，残りがBAR内のオフセット
+        uint32_t table;
+        uint32_t pba;
+    } __attribute__((packed));
+
+    // MSI-Xテーブルの1エントリ
+    struct MSIXTableEntry
+    {
+        uint32_t msg_addr;
+        uint32_t msg_upper_addr;
+        uint32_t msg_data;
+        // ビット0がマスク
+        uint32_t vector_control;
+    } __attribute__((packed));
+
+    // MSI-Xを有効にしたデバイスのテーブルとPBA(Pending Bit Array)
+    // エントリ毎に宛先のコアとベクタを変えられるので，複数のキューを持つデバイスの割り込みを各コアに分けられる
+    struct MSIX
+    {
+        unsigned int num_entries;
+        volatile MSIXTableEntry* table;
+        volatile uint64_t* pba;
+    };
+
+    // MSI-Xのテーブルを見つけてアンキャッシュにマップし，全エントリをマスクしてMSI-Xを有効にする
+    // MSIとINTxは無効になる．MSI-Xを持たないデバイスではkNoPCIMSIを返す
+    WithError<MSIX> enable_msix(const Device& dev);
+
+    // index番目のエントリの宛先を設定し，マスクを外す
+    Error configure_msix_entry(const MSIX& msix,
+                               unsigned int index,
+                               uint8_t apic_id,
+                               MSITriggerMode trigger_mode,
+                               MSIDeliveryMode delivery_mode,
+                               uint8_t vector);
+
+    // index番目のエントリをマスクする．マスク中の割り込みはPBAに保留され，マスクを外すと届く
+    Error mask_msix_entry(const MSIX& msix, unsigned int index, bool masked);
+    [[nodiscard]] bool msix_pending(const MSIX& msix, unsigned int index);
 }
 
 #endif //PCI_HPP
@@ -2,6 +2,7 @@
 #define QUEUE_HPP
 
 #include <array>
+#include <atomic>
 
 #include "error.hpp"
 
@@ -57,7 +58,7 @@ Error ArrayQueue<T>::pop()
         return MAKE_ERROR(Error::kEmpty);
     }
 
-    ++count_;
+    --count_;
     ++read_pos;
     if (read_pos == capacity_)
     {
@@ -84,4 +85,105 @@ const T& ArrayQueue<T>::front() const
     return data[read_pos];
 }
 
+/**
+ * 書き込み側と読み出し側がそれぞれ1つだけの場合に使える，ロックを使わないリングバッファ．
+ *
+ * 書き込み位置 head は書き込み側だけが，読み出し位置 tail は読み出し側だけが進める．
+ * 両者は別々のキャッシュラインに置き，要素の受け渡しは acquire/release で順序付ける．
+ * そのため割り込みハンドラが書き込み，メインループが読み出すときに割り込みを禁止する必要がない．
+ * 容量は2のべき乗に限り，位置は容量で剰余を取らずに増やし続けてマスクで添字にする．
+ */
+template <typename T, size_t N>
+class SPSCQueue
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // 書き込み側から呼ぶ
+    Error push(const T& value);
+
+    // 読み出し側から呼ぶ
+    Error pop();
+    [[nodiscard]] const T& front() const;
+    // 最大 max_count 個の要素をまとめて取り出し，取り出した数を返す
+    size_t pop_batch(T* out, size_t max_count);
+
+    [[nodiscard]] size_t count() const;
+
+    [[nodiscard]] static constexpr size_t capacity()
+    {
+        return N;
+    }
+
+    // 書き込み位置．MONITOR命令などで書き込みを監視するときに使う
+    [[nodiscard]] const std::atomic<size_t>& write_position() const
+    {
+        return head;
+    }
+
+private:
+    static constexpr size_t MASK = N - 1;
+
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) T data[N]{};
+};
+
+template <typename T, size_t N>
+Error SPSCQueue<T, N>::push(const T& value)
+{
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == N)
+    {
+        return MAKE_ERROR(Error::kFull);
+    }
+
+    data[h & MASK] = value;
+    head.store(h + 1, std::memory_order_release);
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+template <typename T, size_t N>
+Error SPSCQueue<T, N>::pop()
+{
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (head.load(std::memory_order_acquire) == t)
+    {
+        return MAKE_ERROR(Error::kEmpty);
+    }
+
+    tail.store(t + 1, std::memory_order_release);
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+template <typename T, size_t N>
+const T& SPSCQueue<T, N>::front() const
+{
+    return data[tail.load(std::memory_order_relaxed) & MASK];
+}
+
+template <typename T, size_t N>
+size_t SPSCQueue<T, N>::pop_batch(T* out, const size_t max_count)
+{
+    const size_t t = tail.load(std::memory_order_relaxed);
+    size_t n = head.load(std::memory_order_acquire) - t;
+    if (n > max_count)
+    {
+        n = max_count;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        out[i] = data[(t + i) & MASK];
+    }
+    tail.store(t + n, std::memory_order_release);
+    return n;
+}
+
+template <typename T, size_t N>
+size_t SPSCQueue<T, N>::count() const
+{
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+}
+
 #endif //QUEUE_HPP
@@ -1,8 +1,6 @@
 #include "segment.hpp"
 
-namespace {
-    std::array<SegmentDescriptor, 3> gdt;
-}
+#include "asmfunc.hpp"
 
 void set_code_segment(SegmentDescriptor &desc, DescriptorType type, unsigned int descriptor_privilege_level,
                       uint32_t base, uint32_t limit) {
@@ -32,14 +30,40 @@ void set_data_segment(SegmentDescriptor &desc, DescriptorType type, unsigned int
     desc.bits.default_operation_size = 1;
 }
 
-void setup_segments() {
-    // GDTの0番目はnull descriptorであるため0を設定
-    gdt[0].data = 0;
-    set_code_segment(gdt[1], DescriptorType::ExecuteRead, 0, 0, 0xfffff);
-    set_data_segment(gdt[2], DescriptorType::ReadWrite, 0, 0, 0xfffff);
-    load_gdt
-}
+void set_system_segment(SegmentDescriptor *desc, DescriptorType type, uint64_t base, uint32_t limit) {
+    desc[0].data = 0;
+
+    desc[0].bits.base_low = base & 0xffffu;
+    desc[0].bits.base_middle = (base >> 16) & 0xffu;
+    desc[0].bits.base_high = (base >> 24) & 0xffu;
 
+    desc[0].bits.limit_low = limit & 0xffffu;
+    desc[0].bits.limit_high = (limit >> 16) & 0xfu;
 
+    desc[0].bits.type = type;
+    desc[0].bits.system_segment = 0;
+    desc[0].bits.descriptor_privilege_level = 0;
+    desc[0].bits.present = 1;
 
+    // 2つ目のエントリにはベースアドレスの上位32ビットが入る
+    desc[1].data = base >> 32;
+}
 
+void setup_segments(GlobalDescriptorTable &gdt, TaskStateSegment &tss, uint64_t stack_top) {
+    tss = TaskStateSegment{};
+    tss.rsp[0] = stack_top;
+    // I/O許可ビットマップは持たない
+    tss.io_map_base = sizeof(TaskStateSegment);
+
+    // GDTの0番目はnull descriptorであるため0を設定
+    gdt[0].data = 0;
+    set_code_segment(gdt[KERNEL_CS >> 3], DescriptorType::ExecuteRead, 0, 0, 0xfffff);
+    set_data_segment(gdt[KERNEL_SS >> 3], DescriptorType::ReadWrite, 0, 0, 0xfffff);
+    set_system_segment(&gdt[KERNEL_TSS >> 3], DescriptorType::TSSAvailable,
+                       reinterpret_cast<uint64_t>(&tss), sizeof(TaskStateSegment) - 1);
+
+    LoadGDT(sizeof(gdt) - 1, reinterpret_cast<uintptr_t>(&gdt[0]));
+    SetDSAll(0);
+    SetCSSS(KERNEL_CS, KERNEL_SS);
+    LoadTR(KERNEL_TSS);
+}
@@ -1,5 +1,6 @@
 #ifndef SEGMENT_HPP
 #define SEGMENT_HPP
+#include <array>
 #include <cstdint>
 
 #include "interrupt.hpp"
@@ -36,6 +37,32 @@ void set_data_segment(SegmentDescriptor &desc,
                       uint32_t base,
                       uint32_t limit);
 
-void setup_segments();
+// 64ビットモードのTSS。特権レベルの切り替えや割り込みで使うスタックの番地を持つ
+struct TaskStateSegment {
+    uint32_t reserved0;
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t io_map_base;
+} __attribute__((packed));
+
+// GDTの並び。TSSのディスクリプタは16バイトなので2エントリを使う
+constexpr uint16_t KERNEL_CS = 1 << 3;
+constexpr uint16_t KERNEL_SS = 2 << 3;
+constexpr uint16_t KERNEL_TSS = 3 << 3;
+using GlobalDescriptorTable = std::array<SegmentDescriptor, 5>;
+
+// desc[0]とdesc[1]の2エントリにTSSなどのシステムセグメントを設定する
+void set_system_segment(SegmentDescriptor *desc,
+                        DescriptorType type,
+                        uint64_t base,
+                        uint32_t limit);
+
+// コアごとのGDTとTSSを作ってロードし、セグメントレジスタとタスクレジスタを設定し直す
+// stack_topは特権レベル0への切り替えで使うスタックの末尾
+// GSのベースは0になるので、コアごとのデータを指すよう後から設定し直すこと
+void setup_segments(GlobalDescriptorTable &gdt, TaskStateSegment &tss, uint64_t stack_top);
 
 #endif //SEGMENT_HPP
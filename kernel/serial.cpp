@@ -0,0 +1,169 @@
+#include "serial.hpp"
+
+#include "asmfunc.hpp"
+#include "interrupt.hpp"
+
+namespace
+{
+    // ポートからのオフセット
+    constexpr uint16_t THR = 0; // 送信保持レジスタ (DLAB=0，書き込み)
+    constexpr uint16_t RBR = 0; // 受信バッファレジスタ (DLAB=0，読み出し)
+    constexpr uint16_t DLL = 0; // 分周比の下位 (DLAB=1)
+    constexpr uint16_t IER = 1; // 割り込み許可レジスタ (DLAB=0)
+    constexpr uint16_t DLM = 1; // 分周比の上位 (DLAB=1)
+    constexpr uint16_t IIR = 2; // 割り込み識別レジスタ（読み出し）
+    constexpr uint16_t FCR = 2; // FIFO制御レジスタ（書き込み）
+    constexpr uint16_t LCR = 3;
+    constexpr uint16_t MCR = 4;
+    constexpr uint16_t LSR = 5;
+    constexpr uint16_t MSR = 6;
+    constexpr uint16_t SCR = 7;
+
+    constexpr uint8_t IER_RDA = 1u << 0;
+    constexpr uint8_t IER_THRE = 1u << 1;
+    // IIR の最下位ビットが立っていれば保留中の要因はない．ビット1..3が要因を表す
+    constexpr uint8_t IIR_NO_INTERRUPT = 1u << 0;
+    constexpr uint8_t IIR_ID_MASK = 0x0e;
+    constexpr uint8_t IIR_MODEM_STATUS = 0x00;
+    constexpr uint8_t IIR_LINE_STATUS = 0x06;
+    constexpr uint8_t LSR_DR = 1u << 0;
+    constexpr uint8_t LSR_THRE = 1u << 5;
+    constexpr uint8_t LCR_DLAB = 1u << 7;
+    constexpr uint8_t LCR_8N1 = 0x03;
+    // FIFO有効，受信・送信FIFOをクリア，受信トリガ14バイト
+    constexpr uint8_t FCR_ENABLE = 0xc7;
+    // DTR, RTS, OUT2（OUT2が割り込み信号をPICやI/O APICへつなぐ）
+    constexpr uint8_t MCR_DTR_RTS_OUT2 = 0x0b;
+}
+
+Error SerialPort::initialize()
+{
+    // スクラッチレジスタに書いた値が読めなければUARTはない
+    IoOut8(port + SCR, 0x5a);
+    if (IoIn8(port + SCR) != 0x5a)
+    {
+        return MAKE_ERROR(Error::kNoSerialPort);
+    }
+
+    IoOut8(port + IER, 0);
+    IoOut8(port + LCR, LCR_DLAB);
+    IoOut8(port + DLL, 1); // 115200 / 1
+    IoOut8(port + DLM, 0);
+    IoOut8(port + LCR, LCR_8N1);
+    IoOut8(port + FCR, FCR_ENABLE);
+    IoOut8(port + MCR, MCR_DTR_RTS_OUT2);
+
+    present = true;
+    // 初期化前に書かれた分があれば送り始める
+    enable_tx_interrupt(tx_head.load(std::memory_order_acquire) != tx_tail.load(std::memory_order_relaxed));
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+void SerialPort::set_receive_observer(const ReceiveObserver observer)
+{
+    receive_observer = observer;
+}
+
+void SerialPort::write(const char* s)
+{
+    size_t head = tx_head.load(std::memory_order_relaxed);
+    const size_t tail = tx_tail.load(std::memory_order_acquire);
+    for (; *s; ++s)
+    {
+        if (head - tail == TX_BUFFER_SIZE)
+        {
+            while (*s++)
+            {
+                ++dropped_;
+            }
+            break;
+        }
+        tx_buffer[head & (TX_BUFFER_SIZE - 1)] = *s;
+        ++head;
+    }
+    tx_head.store(head, std::memory_order_release);
+
+    // THR 空き割り込みを許可すると，THR が空いていればすぐに割り込みが起きて送信が始まる
+    if (present)
+    {
+        enable_tx_interrupt(true);
+    }
+}
+
+void SerialPort::on_interrupt()
+{
+    // I/O APIC はエッジトリガなので，要因が1つでも残っていると割り込み信号が下がらず，次の割り込みが来ない
+    // 保留中の要因がなくなるまで処理する．IIR を読むと THR 空き割り込みの要因が解除される
+    uint8_t iir;
+    while (!((iir = IoIn8(port + IIR)) & IIR_NO_INTERRUPT))
+    {
+        switch (iir & IIR_ID_MASK)
+        {
+        case IIR_LINE_STATUS:
+            IoIn8(port + LSR);
+            break;
+        case IIR_MODEM_STATUS:
+            IoIn8(port + MSR);
+            break;
+        default:
+            // 受信データあり，受信タイムアウト，THR 空き
+            receive();
+            if (IoIn8(port + LSR) & LSR_THRE)
+            {
+                fill_tx_fifo();
+            }
+            break;
+        }
+    }
+}
+
+void SerialPort::start()
+{
+    if (!present)
+    {
+        return;
+    }
+    // 保留中の要因をすべて処理すれば割り込み信号が下がり，次の要因で改めてエッジが届く
+    const auto rflags = save_and_disable_interrupts();
+    on_interrupt();
+    restore_interrupts(rflags);
+}
+
+void SerialPort::receive()
+{
+    while (IoIn8(port + LSR) & LSR_DR)
+    {
+        const char c = static_cast<char>(IoIn8(port + RBR));
+        if (receive_observer)
+        {
+            receive_observer(c);
+        }
+    }
+}
+
+void SerialPort::fill_tx_fifo()
+{
+    size_t tail = tx_tail.load(std::memory_order_relaxed);
+    size_t head = tx_head.load(std::memory_order_acquire);
+    for (int i = 0; i < TX_FIFO_SIZE && tail != head; ++i)
+    {
+        IoOut8(port + THR, tx_buffer[tail & (TX_BUFFER_SIZE - 1)]);
+        ++tail;
+    }
+    tx_tail.store(tail, std::memory_order_release);
+
+    if (tail == head)
+    {
+        // 送るものがなくなったら割り込みを止める．止めた直後に書き込まれていたら再開する
+        enable_tx_interrupt(false);
+        if (tx_head.load(std::memory_order_acquire) != tail)
+        {
+            enable_tx_interrupt(true);
+        }
+    }
+}
+
+void SerialPort::enable_tx_interrupt(const bool enable)
+{
+    IoOut8(port + IER, IER_RDA | (enable ? IER_THRE : 0));
+}
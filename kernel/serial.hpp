@@ -0,0 +1,75 @@
+#ifndef SERIAL_HPP
+#define SERIAL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+
+/**
+ * 16550 互換UARTのドライバ．
+ *
+ * write() は送信リングにコピーするだけで，実際の送信は THR 空き割り込みのハンドラが
+ * 16バイトの送信FIFOをまとめて埋めることで行う．CPUが1文字毎に送信完了を待つことはない．
+ * 書き込むのは1つのコンテキスト（メインループ），取り出すのは割り込みハンドラだけとする．
+ * 受信した文字は割り込みハンドラの中で受信オブザーバーに1文字ずつ渡す．
+ */
+class SerialPort
+{
+public:
+    static constexpr uint16_t COM1 = 0x3f8;
+    static constexpr uint8_t COM1_IRQ = 4;
+    static constexpr size_t TX_BUFFER_SIZE = 16384;
+    static_assert((TX_BUFFER_SIZE & (TX_BUFFER_SIZE - 1)) == 0, "TX_BUFFER_SIZE must be a power of two");
+
+    using ReceiveObserver = void (*)(char c);
+
+    explicit SerialPort(uint16_t port) : port{port}
+    {
+    }
+
+    // 115200bps, 8N1 に設定し，FIFOと受信割り込みを有効にする．UARTが存在しなければエラーを返す
+    Error initialize();
+    // 受信した文字を割り込みハンドラの中で受け取る関数．nullptrなら受信した文字は捨てる
+    void set_receive_observer(ReceiveObserver observer);
+
+    // 送信リングに文字列をコピーする．入りきらなかった分は捨てて数える
+    void write(const char* s);
+    // 割り込みハンドラから呼ぶ．保留中の要因がなくなるまで送受信を処理する
+    void on_interrupt();
+    // 割り込みの経路（I/O APIC）を設定した後に呼び，溜まっている分を送り始め，受信済みの文字を取り出す
+    // 経路がマスクされている間に起きた割り込みのエッジは失われているので，ここでやり直す
+    void start();
+
+    [[nodiscard]] uint64_t dropped() const
+    {
+        return dropped_;
+    }
+
+    void* operator new(size_t size, void* buf)
+    {
+        return buf;
+    }
+
+    void operator delete(void* obj) noexcept
+    {
+    }
+
+private:
+    static constexpr int TX_FIFO_SIZE = 16;
+
+    void fill_tx_fifo();
+    void enable_tx_interrupt(bool enable);
+    void receive();
+
+    const uint16_t port;
+    bool present{false};
+    ReceiveObserver receive_observer{nullptr};
+    char tx_buffer[TX_BUFFER_SIZE]{};
+    std::atomic<size_t> tx_head{0}; // 次に書き込む位置（write が進める）
+    std::atomic<size_t> tx_tail{0}; // 次に送信する位置（割り込みハンドラが進める）
+    uint64_t dropped_{0};
+};
+
+#endif //SERIAL_HPP
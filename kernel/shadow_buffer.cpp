@@ -0,0 +1,114 @@
+#include "shadow_buffer.hpp"
+
+#include <cstring>
+
+namespace
+{
+    int area(const Rectangle<int>& rect)
+    {
+        return rect.size.x * rect.size.y;
+    }
+
+    // 重なっているか，辺で接している
+    bool touches(const Rectangle<int>& lhs, const Rectangle<int>& rhs)
+    {
+        return lhs.pos.x <= rhs.right() && rhs.pos.x <= lhs.right() &&
+            lhs.pos.y <= rhs.bottom() && rhs.pos.y <= lhs.bottom();
+    }
+}
+
+void ShadowFrameBuffer::write(const int x, const int y, const PixelColor& color)
+{
+    if (x < 0 || y < 0 || x >= width() || y >= height())
+    {
+        return;
+    }
+    shadow_writer.write(x, y, color);
+    mark_dirty({{x, y}, {1, 1}});
+}
+
+void ShadowFrameBuffer::fill_span(const int x, const int y, const int width, const uint32_t pixel)
+{
+    shadow_writer.fill_span(x, y, width, pixel);
+    mark_dirty({{x, y}, {width, 1}});
+}
+
+void ShadowFrameBuffer::fill_rect(const Vector2D<int>& pos, const Vector2D<int>& size, const uint32_t pixel)
+{
+    shadow_writer.fill_rect(pos, size, pixel);
+    mark_dirty({pos, size});
+}
+
+void ShadowFrameBuffer::write_row(const int x, const int y, const uint32_t* pixels, const int width)
+{
+    shadow_writer.write_row(x, y, pixels, width);
+    mark_dirty({{x, y}, {width, 1}});
+}
+
+void ShadowFrameBuffer::write_bitmap(const int x, const int y, const uint8_t* rows, const int width, const int height,
+                                     const uint32_t pixel)
+{
+    shadow_writer.write_bitmap(x, y, rows, width, height, pixel);
+    mark_dirty({{x, y}, {width, height}});
+}
+
+void ShadowFrameBuffer::move_rect(const Vector2D<int>& dst_pos, const Rectangle<int>& src)
+{
+    shadow_writer.move_rect(dst_pos, src);
+    mark_dirty({dst_pos, src.size});
+}
+
+void ShadowFrameBuffer::mark_dirty(const Rectangle<int>& rect)
+{
+    const auto clipped = rect & Rectangle<int>{{0, 0}, {width(), height()}};
+    if (clipped.empty())
+    {
+        return;
+    }
+
+    // 既存の矩形と接していればまとめる．1行の文字列のような連続した書き込みは1つの矩形になる
+    for (int i = 0; i < num_dirty_rects; ++i)
+    {
+        if (touches(dirty_rects[i], clipped))
+        {
+            dirty_rects[i] = dirty_rects[i] | clipped;
+            return;
+        }
+    }
+
+    if (num_dirty_rects < MAX_DIRTY_RECTS)
+    {
+        dirty_rects[num_dirty_rects++] = clipped;
+        return;
+    }
+
+    // 空きがなければ，合併したときに面積の増加が最も小さい矩形に取り込む
+    int best = 0;
+    int best_growth = area(dirty_rects[0] | clipped) - area(dirty_rects[0]);
+    for (int i = 1; i < num_dirty_rects; ++i)
+    {
+        const int growth = area(dirty_rects[i] | clipped) - area(dirty_rects[i]);
+        if (growth < best_growth)
+        {
+            best = i;
+            best_growth = growth;
+        }
+    }
+    dirty_rects[best] = dirty_rects[best] | clipped;
+}
+
+void ShadowFrameBuffer::flush()
+{
+    for (int i = 0; i < num_dirty_rects; ++i)
+    {
+        const auto& rect = dirty_rects[i];
+        const auto bytes_per_row = 4 * rect.size.x;
+        for (int y = rect.pos.y; y < rect.bottom(); ++y)
+        {
+            const auto src = shadow_config.frame_buffer + 4 * (shadow_config.pixels_per_scan_line * y + rect.pos.x);
+            const auto dst = screen_config.frame_buffer + 4 * (screen_config.pixels_per_scan_line * y + rect.pos.x);
+            memcpy(dst, src, bytes_per_row);
+        }
+    }
+    num_dirty_rects = 0;
+}
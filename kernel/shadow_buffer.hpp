@@ -0,0 +1,70 @@
+#ifndef SHADOW_BUFFER_HPP
+#define SHADOW_BUFFER_HPP
+
+#include <array>
+
+#include "graphics.hpp"
+
+/**
+ * 通常のRAM上に置いたフレームバッファの複製（シャドウバッファ）への描画を行い，
+ * 変更のあった矩形を記録しておく PixelWriter．
+ *
+ * 実際のフレームバッファはキャッシュされないビデオメモリなので，細かい書き込みを
+ * そのまま行う代わりに flush() でまとめて行単位の連続コピーとして書き出す．
+ * 描画はピクセル形式毎の shadow_writer に任せ，ここでは変更のあった矩形を記録するだけにする．
+ */
+class ShadowFrameBuffer final : public PixelWriter
+{
+public:
+    static constexpr int MAX_DIRTY_RECTS = 16;
+
+    /**
+     * @param shadow_config  シャドウバッファ（RAM）の設定．ピクセル形式は画面と同じであること
+     * @param shadow_writer  shadow_config 上に作られたピクセル形式毎の PixelWriter
+     * @param screen_config  書き出し先の実際のフレームバッファの設定
+     */
+    ShadowFrameBuffer(const FrameBufferConfig& shadow_config, PixelWriter& shadow_writer,
+                      const FrameBufferConfig& screen_config)
+        : PixelWriter(shadow_config),
+          shadow_config(shadow_config), shadow_writer(shadow_writer), screen_config(screen_config),
+          dirty_rects{}, num_dirty_rects{0}
+    {
+    }
+
+    void write(int x, int y, const PixelColor& color) override;
+
+    [[nodiscard]] uint32_t to_pixel(const PixelColor& color) const override
+    {
+        return shadow_writer.to_pixel(color);
+    }
+
+    void fill_span(int x, int y, int width, uint32_t pixel) override;
+    void fill_rect(const Vector2D<int>& pos, const Vector2D<int>& size, uint32_t pixel) override;
+    void write_row(int x, int y, const uint32_t* pixels, int width) override;
+    void write_bitmap(int x, int y, const uint8_t* rows, int width, int height, uint32_t pixel) override;
+    void move_rect(const Vector2D<int>& dst_pos, const Rectangle<int>& src) override;
+
+    // 記録された矩形をフレームバッファへ書き出し，記録を空にする
+    void flush();
+
+    void* operator new(size_t size, void* buf)
+    {
+        return buf;
+    }
+
+    void operator delete(void* obj) noexcept
+    {
+    }
+
+private:
+    void mark_dirty(const Rectangle<int>& rect);
+
+    const FrameBufferConfig& shadow_config;
+    PixelWriter& shadow_writer;
+    const FrameBufferConfig& screen_config;
+    std::array<Rectangle<int>, MAX_DIRTY_RECTS> dirty_rects;
+    int num_dirty_rects;
+};
+
+
+#endif //SHADOW_BUFFER_HPP
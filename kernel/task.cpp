@@ -0,0 +1,226 @@
+#include "task.hpp"
+
+#include <cstring>
+
+#include "asmfunc.hpp"
+#include "interrupt.hpp"
+#include "timer.hpp"
+#include "timing.hpp"
+#include "trace.hpp"
+
+namespace
+{
+    constexpr uint64_t RFLAGS_INTERRUPT_ENABLE = 1u << 9;
+    // FXSAVE 領域の x87 制御ワードと MXCSR の位置と，リセット時の値（例外はすべてマスク）
+    constexpr size_t FXSAVE_FCW_OFFSET = 0;
+    constexpr size_t FXSAVE_MXCSR_OFFSET = 24;
+    constexpr uint16_t DEFAULT_FCW = 0x037f;
+    constexpr uint32_t DEFAULT_MXCSR = 0x1f80;
+
+    Task::Function idle_function;
+    void* idle_arg;
+
+    void idle_task_main(void*)
+    {
+        while (true)
+        {
+            idle_function(idle_arg);
+            task_manager->yield();
+        }
+    }
+}
+
+void TaskManager::initialize(const Task::Function idle_function, void* const idle_arg)
+{
+    ::idle_function = idle_function;
+    ::idle_arg = idle_arg;
+
+    // メインタスクのレジスタは最初に切り替えるときに退避される
+    main_task_ = new Task;
+    main_task_->id_ = next_id++;
+    main_task_->priority_ = DEFAULT_PRIORITY;
+    main_task_->state_ = Task::State::kRunning;
+    current_ = main_task_;
+    num_tasks = 1;
+    slice_end = timing::now() + timing::frequency() * TIME_SLICE_MS / 1000;
+
+    new_task(idle_task_main, nullptr, IDLE_PRIORITY);
+}
+
+Task* TaskManager::new_task(const Task::Function function, void* const arg, const int priority,
+                            const size_t stack_size)
+{
+    auto task = new Task;
+    task->function = function;
+    task->arg = arg;
+    task->priority_ = priority;
+    task->stack = new uint8_t[stack_size];
+
+    // 最初の切り替えでは SwitchContext() の ret で task_entry() に入る．
+    // 関数の入口と同じく，戻りアドレスを積んだ状態で rsp が 16 の倍数 + 8 になるようにする
+    const auto stack_end = reinterpret_cast<uintptr_t>(task->stack + stack_size) & ~static_cast<uintptr_t>(0xf);
+    task->context.rsp = stack_end - 16;
+    *reinterpret_cast<uint64_t*>(task->context.rsp) = reinterpret_cast<uint64_t>(task_entry);
+    task->context.rflags = RFLAGS_INTERRUPT_ENABLE;
+    memcpy(&task->context.fxsave_area[FXSAVE_FCW_OFFSET], &DEFAULT_FCW, sizeof(DEFAULT_FCW));
+    memcpy(&task->context.fxsave_area[FXSAVE_MXCSR_OFFSET], &DEFAULT_MXCSR, sizeof(DEFAULT_MXCSR));
+
+    const auto rflags = save_and_disable_interrupts();
+    task->id_ = next_id++;
+    ++num_tasks;
+    enqueue(*task);
+    update_preemption_timer();
+    restore_interrupts(rflags);
+    return task;
+}
+
+void TaskManager::wakeup(Task& task)
+{
+    const auto rflags = save_and_disable_interrupts();
+    if (task.state_ == Task::State::kBlocked)
+    {
+        enqueue(task);
+    }
+    restore_interrupts(rflags);
+}
+
+void TaskManager::yield()
+{
+    const auto rflags = save_and_disable_interrupts();
+    if (highest_ready_priority() <= current_->priority_)
+    {
+        schedule();
+    }
+    restore_interrupts(rflags);
+}
+
+void TaskManager::sleep()
+{
+    const auto rflags = save_and_disable_interrupts();
+    current_->state_ = Task::State::kBlocked;
+    schedule();
+    restore_interrupts(rflags);
+}
+
+void TaskManager::exit()
+{
+    save_and_disable_interrupts();
+    current_->state_ = Task::State::kDead;
+    current_->next = dead_tasks;
+    dead_tasks = current_;
+    schedule();
+    __builtin_unreachable();
+}
+
+void TaskManager::on_timer_interrupt()
+{
+    // 割り込みハンドラの中なので割り込みは禁止されている
+    const int top = highest_ready_priority();
+    if (top < current_->priority_ ||
+        (top == current_->priority_ && timing::now() >= slice_end))
+    {
+        TRACE(kDebug, "task: preempt %lu (priority %ld)\n", current_->id_, current_->priority_);
+        schedule();
+    }
+}
+
+void TaskManager::task_entry()
+{
+    // 割り込みを許可した状態で入ってくる
+    auto& task = task_manager->current();
+    task.function(task.arg);
+    task_manager->exit();
+}
+
+void TaskManager::enqueue(Task& task)
+{
+    task.state_ = Task::State::kReady;
+    task.next = nullptr;
+    auto& queue = ready[task.priority_];
+    if (queue.tail)
+    {
+        queue.tail->next = &task;
+    }
+    else
+    {
+        queue.head = &task;
+    }
+    queue.tail = &task;
+    ready_bitmap |= 1u << task.priority_;
+}
+
+Task* TaskManager::dequeue(const int priority)
+{
+    auto& queue = ready[priority];
+    Task* task = queue.head;
+    queue.head = task->next;
+    if (queue.head == nullptr)
+    {
+        queue.tail = nullptr;
+        ready_bitmap &= ~(1u << priority);
+    }
+    task->next = nullptr;
+    return task;
+}
+
+int TaskManager::highest_ready_priority() const
+{
+    return ready_bitmap ? __builtin_ctz(ready_bitmap) : NUM_PRIORITIES;
+}
+
+void TaskManager::schedule()
+{
+    Task& prev = *current_;
+    if (prev.state_ == Task::State::kRunning)
+    {
+        enqueue(prev);
+    }
+    // アイドルタスクは眠らないので，実行可能なタスクは常に1つ以上ある
+    Task& next = *dequeue(highest_ready_priority());
+    if (&next == &prev)
+    {
+        prev.state_ = Task::State::kRunning;
+        slice_end = timing::now() + timing::frequency() * TIME_SLICE_MS / 1000;
+        return;
+    }
+    switch_to(next);
+}
+
+void TaskManager::switch_to(Task& next)
+{
+    Task& prev = *current_;
+    next.state_ = Task::State::kRunning;
+    current_ = &next;
+    slice_end = timing::now() + timing::frequency() * TIME_SLICE_MS / 1000;
+    ++switches_;
+    SwitchContext(&next.context, &prev.context);
+
+    // prev に再び切り替わるとここから続く
+    reap_dead_tasks();
+}
+
+void TaskManager::reap_dead_tasks()
+{
+    if (dead_tasks == nullptr)
+    {
+        return;
+    }
+    while (dead_tasks)
+    {
+        Task* task = dead_tasks;
+        dead_tasks = task->next;
+        delete[] task->stack;
+        delete task;
+        --num_tasks;
+    }
+    update_preemption_timer();
+}
+
+void TaskManager::update_preemption_timer()
+{
+    // メインタスクとアイドルタスクのほかにタスクがあるときだけ，タイムスライス毎に割り込ませる
+    if (timer_manager)
+    {
+        timer_manager->set_interval_limit(num_tasks > 2 ? TIME_SLICE_MS : 0);
+    }
+}
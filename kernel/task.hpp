@@ -0,0 +1,175 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @file task.hpp
+ *
+ * カーネルのタスクと，優先度付きでプリエンプティブなスケジューラ．
+ *
+ * タスクはそれぞれスタックとレジスタの退避領域を持ち，SwitchContext() で切り替える．
+ * 実行可能なタスクは優先度毎の FIFO に並び，空でない優先度をビットマップで持つので，
+ * 次のタスクは最下位ビットを1回探すだけで決まる．
+ * Local APIC タイマーの割り込みで，より優先度の高いタスクが実行可能になっていれば，
+ * あるいは同じ優先度のタスクがありタイムスライスを使い切っていれば切り替える．
+ *
+ * Local APIC タイマーを動かしているのは BSP だけなので，タスクは BSP で動く．
+ * タスク間で共有するもの（ヒープ，ログの出力先）は割り込みを禁止して触る．
+ * TimerManager と画面の描画はメインタスクだけが使う．
+ */
+
+/**
+ * SwitchContext() が退避するレジスタ．並びは asmfunc.asm と合わせる．
+ * 呼び出し規約で呼び出し側が保存するレジスタは，切り替えの呼び出し元か割り込みハンドラが退避している．
+ * SSE のレジスタはすべて呼び出し側保存だが，割り込みハンドラは退避しないので FXSAVE でまとめて退避する．
+ */
+struct alignas(16) TaskContext
+{
+    uint64_t rsp, rbx, rbp, r12, r13, r14, r15, rflags;
+    alignas(16) uint8_t fxsave_area[512];
+};
+
+static_assert(offsetof(TaskContext, rflags) == 0x38);
+static_assert(offsetof(TaskContext, fxsave_area) == 0x40);
+
+class Task
+{
+public:
+    using Function = void (*)(void* arg);
+
+    enum class State
+    {
+        kReady,
+        kRunning,
+        kBlocked,
+        kDead,
+    };
+
+    [[nodiscard]] uint64_t id() const
+    {
+        return id_;
+    }
+
+    [[nodiscard]] int priority() const
+    {
+        return priority_;
+    }
+
+    [[nodiscard]] State state() const
+    {
+        return state_;
+    }
+
+private:
+    friend class TaskManager;
+
+    TaskContext context{};
+    // 実行可能なタスクの列か，終了したタスクの列での次のタスク
+    Task* next = nullptr;
+    uint64_t id_ = 0;
+    int priority_ = 0;
+    State state_ = State::kReady;
+    Function function = nullptr;
+    void* arg = nullptr;
+    // new_task() で確保したスタック．メインタスクでは nullptr
+    uint8_t* stack = nullptr;
+};
+
+class TaskManager
+{
+public:
+    // 0 が最も高い優先度
+    static constexpr int NUM_PRIORITIES = 8;
+    static constexpr int DEFAULT_PRIORITY = 3;
+    // どのタスクも実行できないときに動くアイドルタスクの優先度
+    static constexpr int IDLE_PRIORITY = NUM_PRIORITIES - 1;
+    static constexpr size_t DEFAULT_STACK_SIZE = 64 * 1024;
+    // 同じ優先度のタスクを切り替える間隔
+    static constexpr uint64_t TIME_SLICE_MS = 10;
+
+    /**
+     * 今動いているコードをメインタスクとして登録し，アイドルタスクを作る．
+     * アイドルタスクは idle_function(idle_arg) を繰り返し呼ぶ．割り込みが来るまで眠る関数を渡す．
+     * timing とヒープを初期化した後に呼ぶ．
+     */
+    void initialize(Task::Function idle_function, void* idle_arg);
+
+    // function(arg) を実行するタスクを作って実行可能にする．function から戻るとタスクは終了する
+    Task* new_task(Task::Function function, void* arg,
+                   int priority = DEFAULT_PRIORITY, size_t stack_size = DEFAULT_STACK_SIZE);
+
+    [[nodiscard]] Task& current() const
+    {
+        return *current_;
+    }
+
+    [[nodiscard]] Task& main_task() const
+    {
+        return *main_task_;
+    }
+
+    // 待っているタスクを実行可能にする．割り込みハンドラからも呼べる．ここでは切り替えない
+    void wakeup(Task& task);
+    // 同じか高い優先度の実行可能なタスクに譲る．なければそのまま戻る
+    void yield();
+    // wakeup() されるまで今のタスクを止める
+    void sleep();
+    // 今のタスクを終了する．スタックは次に動いたタスクが解放する
+    [[noreturn]] void exit();
+
+    // Local APIC タイマーの割り込みハンドラから，EOI を送った後に呼ぶ
+    void on_timer_interrupt();
+
+    [[nodiscard]] uint64_t switches() const
+    {
+        return switches_;
+    }
+
+    void* operator new(size_t size, void* buf)
+    {
+        return buf;
+    }
+
+    void operator delete(void* obj) noexcept
+    {
+    }
+
+private:
+    // 新しいタスクが最初に SwitchContext() から戻る先
+    [[noreturn]] static void task_entry();
+
+    struct ReadyQueue
+    {
+        Task* head = nullptr;
+        Task* tail = nullptr;
+    };
+
+    // 以下は割り込みを禁止して呼ぶ
+    void enqueue(Task& task);
+    Task* dequeue(int priority);
+    [[nodiscard]] int highest_ready_priority() const;
+    // 最も優先度の高い実行可能なタスクに切り替える．今のタスクは状態に応じて列に戻す
+    void schedule();
+    void switch_to(Task& next);
+    void reap_dead_tasks();
+    void update_preemption_timer();
+
+    std::array<ReadyQueue, NUM_PRIORITIES> ready{};
+    // ビット p: 優先度 p の列が空でない
+    uint32_t ready_bitmap = 0;
+    Task* current_ = nullptr;
+    Task* main_task_ = nullptr;
+    Task* dead_tasks = nullptr;
+    // 今のタスクのタイムスライスが終わる時刻（timing::now() の単位）
+    uint64_t slice_end = 0;
+    uint64_t next_id = 0;
+    uint64_t switches_ = 0;
+    int num_tasks = 0;
+};
+
+extern TaskManager* task_manager;
+
+#endif //TASK_HPP
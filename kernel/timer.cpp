@@ -0,0 +1,300 @@
+#include "timer.hpp"
+
+#include "asmfunc.hpp"
+#include "interrupt.hpp"
+
+namespace
+{
+    volatile uint32_t& lvt_timer = *reinterpret_cast<uint32_t*>(0xfee00320);
+    volatile uint32_t& initial_count = *reinterpret_cast<uint32_t*>(0xfee00380);
+    volatile uint32_t& current_count = *reinterpret_cast<uint32_t*>(0xfee00390);
+    volatile uint32_t& divide_config = *reinterpret_cast<uint32_t*>(0xfee003e0);
+
+    constexpr uint32_t COUNT_MAX = 0xffffffffu;
+    constexpr uint32_t LVT_MASKED = 1u << 16;
+    // 分周比16．カウンタが一周するまでに数十秒かかるので，暇なときの割り込みはほぼなくなる
+    constexpr uint32_t DIVIDE_BY_16 = 0b0011;
+
+    // PIT（8254）のチャンネル2で測る
+    constexpr uint64_t PIT_FREQUENCY = 1193182;
+    constexpr uint64_t CALIBRATION_MS = 50;
+    constexpr uint16_t PIT_CH2_DATA = 0x42;
+    constexpr uint16_t PIT_COMMAND = 0x43;
+    // ビット0: チャンネル2のゲート，ビット1: スピーカー出力，ビット5: チャンネル2の出力
+    constexpr uint16_t PIT_CH2_CONTROL = 0x61;
+
+    // PIT が milliseconds ミリ秒を数える間に Local APIC タイマーが進むカウント数を返す
+    uint64_t measure_with_pit(const uint64_t milliseconds)
+    {
+        const auto pit_count = static_cast<uint16_t>(PIT_FREQUENCY * milliseconds / 1000);
+
+        // ゲートを下げて止めておき，モード0（カウント終了で出力が上がる）で設定する
+        const uint8_t control = IoIn8(PIT_CH2_CONTROL) & ~0x03u;
+        IoOut8(PIT_CH2_CONTROL, control);
+        IoOut8(PIT_COMMAND, 0b10110000); // チャンネル2, 下位・上位バイトの順, モード0, 2進
+        IoOut8(PIT_CH2_DATA, pit_count & 0xffu);
+        IoOut8(PIT_CH2_DATA, pit_count >> 8);
+
+        initial_count = COUNT_MAX;
+        IoOut8(PIT_CH2_CONTROL, control | 0x01u);
+        while ((IoIn8(PIT_CH2_CONTROL) & 0x20u) == 0)
+        {
+        }
+        const uint32_t elapsed = COUNT_MAX - current_count;
+        initial_count = 0;
+        return elapsed;
+    }
+
+    uint64_t rotate_right(const uint64_t value, const int shift)
+    {
+        return value >> shift | value << ((64 - shift) & 63);
+    }
+}
+
+void TimerWheel::arm(Timer& timer, uint64_t expires)
+{
+    if (timer.armed())
+    {
+        unlink(timer);
+    }
+    if (expires <= now_)
+    {
+        expires = now_ + 1;
+    }
+    timer.expires_ = expires;
+    insert(timer);
+}
+
+void TimerWheel::cancel(Timer& timer)
+{
+    if (timer.armed())
+    {
+        unlink(timer);
+    }
+}
+
+void TimerWheel::insert(Timer& timer)
+{
+    // 残り時間が収まる最も下の段に置く．最上段に収まらなければ最上段の最も遠いスロットに置き，
+    // カスケードのたびに置き直す
+    const uint64_t delta = timer.expires_ - now_;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >> LEVEL_BITS * (level + 1) != 0)
+    {
+        ++level;
+    }
+    uint64_t position = timer.expires_;
+    if (delta >> LEVEL_BITS * LEVELS != 0)
+    {
+        position = now_ + (1ull << LEVEL_BITS * LEVELS) - 1;
+    }
+    const int slot = position >> LEVEL_BITS * level & (SLOTS - 1);
+
+    Timer*& head = slots[level][slot];
+    timer.next = head;
+    if (head)
+    {
+        head->pprev = &timer.next;
+    }
+    head = &timer;
+    timer.pprev = &head;
+    timer.level = level;
+    timer.slot = slot;
+    occupied[level] |= 1ull << slot;
+}
+
+void TimerWheel::unlink(Timer& timer)
+{
+    *timer.pprev = timer.next;
+    if (timer.next)
+    {
+        timer.next->pprev = timer.pprev;
+    }
+    timer.next = nullptr;
+    timer.pprev = nullptr;
+    // detach() で外したリストから外すときも，スロットが空ならビットを落としてよい
+    if (slots[timer.level][timer.slot] == nullptr)
+    {
+        occupied[timer.level] &= ~(1ull << timer.slot);
+    }
+}
+
+void TimerWheel::detach(const int level, const int slot, Timer*& head)
+{
+    head = slots[level][slot];
+    slots[level][slot] = nullptr;
+    occupied[level] &= ~(1ull << slot);
+    if (head)
+    {
+        head->pprev = &head;
+    }
+}
+
+uint64_t TimerWheel::next_event() const
+{
+    uint64_t next = NEVER;
+    for (int level = 0; level < LEVELS; ++level)
+    {
+        if (occupied[level] == 0)
+        {
+            continue;
+        }
+        // 現在のスロットの次から数えて最初に空でないスロットまでの距離（1〜64）
+        // 段0ではそのスロットの期限，それより上の段ではカスケードする時刻になる
+        const uint64_t index = now_ >> LEVEL_BITS * level;
+        const int current = index & (SLOTS - 1);
+        const int distance = __builtin_ctzll(rotate_right(occupied[level], (current + 1) & (SLOTS - 1))) + 1;
+        const uint64_t time = (index + distance) << LEVEL_BITS * level;
+        if (time < next)
+        {
+            next = time;
+        }
+    }
+    return next;
+}
+
+void TimerWheel::advance(const uint64_t now)
+{
+    // 何も起きないティックは飛ばし，カスケードか期限のあるティックだけを順に訪れる
+    for (uint64_t t = next_event(); t <= now; t = next_event())
+    {
+        now_ = t;
+        for (int level = LEVELS - 1; level > 0; --level)
+        {
+            if ((now_ & ((1ull << LEVEL_BITS * level) - 1)) == 0)
+            {
+                cascade(level);
+            }
+        }
+        expire();
+    }
+    if (now > now_)
+    {
+        now_ = now;
+    }
+}
+
+void TimerWheel::cascade(const int level)
+{
+    Timer* list;
+    detach(level, now_ >> LEVEL_BITS * level & (SLOTS - 1), list);
+    while (list)
+    {
+        Timer& timer = *list;
+        unlink(timer);
+        insert(timer);
+    }
+}
+
+void TimerWheel::expire()
+{
+    // コールバックは別のタイマーを登録・取り消ししてよい．まだ呼んでいないものが
+    // 取り消されたときは，外したリストからそのまま外れる
+    Timer* list;
+    detach(0, now_ & (SLOTS - 1), list);
+    while (list)
+    {
+        Timer& timer = *list;
+        unlink(timer);
+        timer.callback(timer);
+    }
+}
+
+void TimerManager::initialize(const uint8_t vector)
+{
+    divide_config = DIVIDE_BY_16;
+    lvt_timer = LVT_MASKED | vector;
+
+    frequency_ = measure_with_pit(CALIBRATION_MS) * 1000 / CALIBRATION_MS;
+    counts_per_tick = frequency_ / TICK_FREQUENCY;
+
+    // ワンショットモードで割り込みを有効にする
+    lvt_timer = vector;
+    elapsed_counts = 0;
+    programmed_count = 0;
+    reprogram();
+}
+
+uint64_t TimerManager::now_counts() const
+{
+    return elapsed_counts + (programmed_count - current_count);
+}
+
+void TimerManager::arm(Timer& timer, const uint64_t milliseconds)
+{
+    const uint64_t now = now_counts() / counts_per_tick;
+    wheel.arm(timer, now + milliseconds * TICK_FREQUENCY / 1000);
+    reprogram();
+}
+
+void TimerManager::cancel(Timer& timer)
+{
+    // 割り込みが1回余計に起きても process() が何もしないだけなので設定し直さない
+    wheel.cancel(timer);
+}
+
+void TimerManager::process()
+{
+    wheel.advance(now_counts() / counts_per_tick);
+    reprogram();
+}
+
+void TimerManager::set_interval_limit(const uint64_t milliseconds)
+{
+    // どのタスクからも呼ばれるので，メインタスクだけが触るタイマーホイールは読まない
+    const auto rflags = save_and_disable_interrupts();
+    interval_limit_counts = frequency_ * milliseconds / 1000;
+    program_next_interrupt();
+    restore_interrupts(rflags);
+}
+
+void TimerManager::on_interrupt()
+{
+    if (interval_limit_counts != 0)
+    {
+        program_next_interrupt();
+    }
+}
+
+void TimerManager::reprogram()
+{
+    // 割り込みハンドラが now_counts() を読んでも途中の状態が見えないように，更新の間は割り込みを禁止する
+    const auto rflags = save_and_disable_interrupts();
+    deadline_counts = NO_DEADLINE;
+    if (const uint64_t next = wheel.next_event(); next != TimerWheel::NEVER)
+    {
+        deadline_counts = next * counts_per_tick;
+    }
+    program_next_interrupt();
+    restore_interrupts(rflags);
+}
+
+void TimerManager::program_next_interrupt()
+{
+    // 読んでから書くまでの数カウントは時計から抜け落ちるが，設定し直すのはタイマーの処理時とタイムスライス毎だけなので
+    // 実用上は問題にならない
+    elapsed_counts += programmed_count - current_count;
+
+    // 期限を過ぎても，process() がホイールを進めるまで deadline_counts は残る．メインループへの通知は済んでいるので，
+    // その間は上限の間隔で割り込めばよい．1カウント後に割り込ませ続けると，メインタスクより優先度の高いタスクが
+    // 動き続けている間は割り込みだけでCPUが埋まってしまう
+    uint64_t count = 1;
+    if (deadline_counts > elapsed_counts)
+    {
+        count = deadline_counts - elapsed_counts;
+    }
+    else if (interval_limit_counts != 0)
+    {
+        count = interval_limit_counts;
+    }
+    if (count > COUNT_MAX)
+    {
+        count = COUNT_MAX;
+    }
+    if (interval_limit_counts != 0 && count > interval_limit_counts)
+    {
+        count = interval_limit_counts;
+    }
+    programmed_count = count;
+    initial_count = programmed_count;
+}
@@ -0,0 +1,180 @@
+#ifndef TIMER_HPP
+#define TIMER_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+/**
+ * @file timer.hpp
+ *
+ * Local APIC タイマーと，その上に構築するタイマーホイールを提供する．
+ */
+
+/**
+ * 期限付きの処理1つ分．利用側が持ち，TimerWheel にリストの要素として直接つながれる．
+ * つなぐ・外すのにメモリ確保は要らない．
+ */
+class Timer
+{
+public:
+    using Callback = void (*)(Timer& timer);
+
+    explicit Timer(Callback callback, void* context = nullptr) : callback{callback}, context_{context}
+    {
+    }
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    [[nodiscard]] bool armed() const
+    {
+        return pprev != nullptr;
+    }
+
+    // 期限（ティック）．armed() のときだけ意味を持つ
+    [[nodiscard]] uint64_t expires() const
+    {
+        return expires_;
+    }
+
+    [[nodiscard]] void* context() const
+    {
+        return context_;
+    }
+
+private:
+    friend class TimerWheel;
+
+    Timer* next = nullptr;
+    // 自分を指しているポインタ（リストの先頭か直前の要素の next）へのポインタ
+    Timer** pprev = nullptr;
+    uint64_t expires_ = 0;
+    uint8_t level = 0, slot = 0;
+    Callback callback;
+    void* context_;
+};
+
+/**
+ * 階層化タイマーホイール．
+ *
+ * 各段は64個のスロットを持ち，段 k のスロット1個は 64^k ティックを表す．
+ * 期限までの残りが短いタイマーほど下の段に置かれ，上の段のスロットは
+ * その範囲に入った時点で下の段へ振り分け直される（カスケード）．
+ * 登録と取り消しはリストの付け外しだけなので，タイマーの数に依らず O(1) である．
+ * 段毎に空でないスロットのビットマップを持ち，次に何かが起きるティックを
+ * 段数に比例する手間で求められるので，何も起きない間のティックを1つずつ辿る必要はない．
+ */
+class TimerWheel
+{
+public:
+    static constexpr int LEVEL_BITS = 6;
+    static constexpr int SLOTS = 1 << LEVEL_BITS;
+    static constexpr int LEVELS = 4;
+    static constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+    [[nodiscard]] uint64_t now() const
+    {
+        return now_;
+    }
+
+    // 期限 expires で timer を登録する．登録済みなら付け替える．
+    // 既に過ぎた期限は次のティックとして扱う
+    void arm(Timer& timer, uint64_t expires);
+    void cancel(Timer& timer);
+
+    // 次に期限を迎えるか，カスケードが必要になるティック．タイマーがなければ NEVER
+    [[nodiscard]] uint64_t next_event() const;
+    // 現在時刻を now まで進め，その間に期限を迎えたタイマーのコールバックを呼ぶ
+    void advance(uint64_t now);
+
+private:
+    void insert(Timer& timer);
+    void unlink(Timer& timer);
+    // スロットのリストを丸ごと外して返す．返したリストの要素の pprev は head を指す
+    void detach(int level, int slot, Timer*& head);
+    void cascade(int level);
+    void expire();
+
+    uint64_t now_ = 0;
+    std::array<std::array<Timer*, SLOTS>, LEVELS> slots{};
+    std::array<uint64_t, LEVELS> occupied{};
+};
+
+/**
+ * Local APIC タイマーで TimerWheel を駆動する．
+ *
+ * タイマーは周期モードでは使わず，次に何かが起きるティックに合わせてワンショットで設定する．
+ * したがって登録されたタイマーがなければ割り込みはほぼ起きない．
+ * 設定したカウントのうち進んだ分を積算して単調増加の時計としても使う．
+ */
+class TimerManager
+{
+public:
+    // ティックの周波数 [Hz]
+    static constexpr uint64_t TICK_FREQUENCY = 1000;
+
+    // PIT を基準に Local APIC タイマーの周波数を測り，vector で割り込むように設定する
+    void initialize(uint8_t vector);
+
+    // Local APIC タイマーが1秒に進むカウント数
+    [[nodiscard]] uint64_t frequency() const
+    {
+        return frequency_;
+    }
+
+    // initialize() からの経過時間（Local APIC タイマーのカウント数）．割り込みハンドラからも呼べる
+    [[nodiscard]] uint64_t now_counts() const;
+
+    [[nodiscard]] uint64_t now() const
+    {
+        return wheel.now();
+    }
+
+    // 今から milliseconds ミリ秒後に timer のコールバックを呼ぶ
+    void arm(Timer& timer, uint64_t milliseconds);
+    void cancel(Timer& timer);
+
+    // メインループから呼ぶ．期限を迎えたタイマーを処理し，次の割り込みを設定し直す
+    void process();
+
+    // 割り込みの間隔の上限．0 なら上限なし．タスクを時分割するときに設定する
+    void set_interval_limit(uint64_t milliseconds);
+    // 割り込みハンドラから呼ぶ．間隔に上限があれば次の割り込みを設定し直し，
+    // メインループが動かず process() が呼ばれない間も上限毎に割り込ませる
+    void on_interrupt();
+
+    void* operator new(size_t size, void* buf)
+    {
+        return buf;
+    }
+
+    void operator delete(void* obj) noexcept
+    {
+    }
+
+private:
+    static constexpr uint64_t NO_DEADLINE = std::numeric_limits<uint64_t>::max();
+
+    // タイマーホイールから次の期限を求めて次の割り込みを設定する．メインループからだけ呼ぶ
+    void reprogram();
+    // deadline_counts と間隔の上限から次の割り込みを設定する．割り込みを禁止して呼ぶ
+    void program_next_interrupt();
+
+    TimerWheel wheel;
+    uint64_t frequency_ = 0;
+    uint64_t counts_per_tick = 0;
+    // 直前に設定し直すまでに進んだカウントの合計
+    uint64_t elapsed_counts = 0;
+    // 現在ワンショットで設定しているカウント
+    uint32_t programmed_count = 0;
+    // ワンショットで設定するカウントの上限．0 なら上限なし
+    uint64_t interval_limit_counts = 0;
+    // 次のタイマーの期限（elapsed_counts の単位）．割り込みハンドラはホイールの代わりにこれを読む
+    uint64_t deadline_counts = NO_DEADLINE;
+};
+
+extern TimerManager* timer_manager;
+
+#endif //TIMER_HPP
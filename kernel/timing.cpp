@@ -0,0 +1,144 @@
+#include "timing.hpp"
+
+#include <cpuid.h>
+
+namespace
+{
+    const TimerManager* fallback_timer;
+    bool tsc_invariant = false;
+    uint64_t clock_frequency = 1;
+    // カウントをナノ秒にする係数（32ビットの固定小数点）
+    uint64_t ns_multiplier = 0;
+
+    constexpr uint64_t NS_PER_SECOND = 1'000'000'000;
+    constexpr int NS_SHIFT = 32;
+    constexpr uint64_t CALIBRATION_MS = 50;
+
+    uint64_t read_tsc()
+    {
+        // 前の命令が終わる前に読まないようにする
+        __asm__ volatile("lfence" ::: "memory");
+        return __builtin_ia32_rdtsc();
+    }
+
+    bool has_invariant_tsc()
+    {
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007)
+        {
+            return false;
+        }
+        __cpuid(0x80000007, eax, ebx, ecx, edx);
+        return edx & (1u << 8);
+    }
+
+    // CPUID 0x15 から TSC の周波数が分かればそれを返す．分からなければ0
+    uint64_t tsc_frequency_from_cpuid()
+    {
+        unsigned int denominator, numerator, crystal_hz, edx;
+        if (__get_cpuid_max(0, nullptr) < 0x15)
+        {
+            return 0;
+        }
+        __cpuid(0x15, denominator, numerator, crystal_hz, edx);
+        if (denominator == 0 || numerator == 0 || crystal_hz == 0)
+        {
+            return 0;
+        }
+        return static_cast<uint64_t>(crystal_hz) * numerator / denominator;
+    }
+
+    // 較正済みの Local APIC タイマーを基準に TSC の周波数を測る
+    uint64_t measure_tsc_frequency(const TimerManager& timer)
+    {
+        const uint64_t counts = timer.frequency() * CALIBRATION_MS / 1000;
+
+        // カウントが変わった直後から測り始める
+        const uint64_t first = timer.now_counts();
+        while (timer.now_counts() == first)
+        {
+        }
+        const uint64_t tsc_start = read_tsc();
+        const uint64_t counts_start = timer.now_counts();
+        uint64_t counts_end;
+        while ((counts_end = timer.now_counts()) - counts_start < counts)
+        {
+        }
+        const uint64_t tsc_end = read_tsc();
+        return (tsc_end - tsc_start) * timer.frequency() / (counts_end - counts_start);
+    }
+}
+
+namespace timing
+{
+    void initialize(const TimerManager& fallback)
+    {
+        fallback_timer = &fallback;
+        tsc_invariant = has_invariant_tsc();
+        if (tsc_invariant)
+        {
+            clock_frequency = tsc_frequency_from_cpuid();
+            if (clock_frequency == 0)
+            {
+                clock_frequency = measure_tsc_frequency(fallback);
+            }
+        }
+        else
+        {
+            clock_frequency = fallback.frequency();
+        }
+        ns_multiplier = (NS_PER_SECOND << NS_SHIFT) / clock_frequency;
+
+        log(kInfo, "clock: %s, %lu Hz\n", tsc_invariant ? "invariant TSC" : "Local APIC timer", clock_frequency);
+    }
+
+    bool uses_tsc()
+    {
+        return tsc_invariant;
+    }
+
+    uint64_t now()
+    {
+        if (tsc_invariant)
+        {
+            return read_tsc();
+        }
+        // initialize() の前に測られたものは0として扱う
+        return fallback_timer ? fallback_timer->now_counts() : 0;
+    }
+
+    uint64_t frequency()
+    {
+        return clock_frequency;
+    }
+
+    uint64_t to_nanoseconds(const uint64_t counts)
+    {
+        return static_cast<unsigned __int128>(counts) * ns_multiplier >> NS_SHIFT;
+    }
+}
+
+void LatencyStats::add(const uint64_t counts)
+{
+    ++count;
+    total += counts;
+    if (counts < min)
+    {
+        min = counts;
+    }
+    if (counts > max)
+    {
+        max = counts;
+    }
+}
+
+void LatencyStats::report(const char* name, const LogLevel level) const
+{
+    if (count == 0)
+    {
+        log(level, "%s: no samples\n", name);
+        return;
+    }
+    log(level, "%s: n=%lu min=%lu avg=%lu max=%lu ns\n", name, count,
+        timing::to_nanoseconds(min), timing::to_nanoseconds(total / count), timing::to_nanoseconds(max));
+}
@@ -0,0 +1,78 @@
+#ifndef TIMING_HPP
+#define TIMING_HPP
+
+#include <cstdint>
+#include <limits>
+
+#include "logger.hpp"
+#include "timer.hpp"
+
+/**
+ * @file timing.hpp
+ *
+ * 処理時間を測るための単調増加の時計を提供する．
+ *
+ * 不変 TSC（周波数が電力状態によらず一定の TSC）があればそれを使い，
+ * なければ Local APIC タイマーのカウントで代用する．どちらも読むだけなので割り込みハンドラからも呼べる．
+ */
+
+namespace timing
+{
+    // fallback は初期化済みであること．TSC の周波数を測るのにも使う
+    // これより前の now() は0を返す
+    void initialize(const TimerManager& fallback);
+
+    [[nodiscard]] bool uses_tsc();
+
+    // 時計の現在値（TSC か Local APIC タイマーのカウント）
+    [[nodiscard]] uint64_t now();
+    // 時計が1秒に進む数
+    [[nodiscard]] uint64_t frequency();
+    [[nodiscard]] uint64_t to_nanoseconds(uint64_t counts);
+
+    [[nodiscard]] inline uint64_t nanoseconds()
+    {
+        return to_nanoseconds(now());
+    }
+}
+
+/**
+ * 同じ処理を何回か測った時間の最小・平均・最大．値は timing::now() の単位で持つ．
+ * 更新は排他しないので，1つの LatencyStats は1つの文脈（メインループか特定の割り込みハンドラ）からだけ更新する．
+ */
+struct LatencyStats
+{
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t min = std::numeric_limits<uint64_t>::max();
+    uint64_t max = 0;
+
+    void add(uint64_t counts);
+    // name の付いた1行としてログに出す
+    void report(const char* name, LogLevel level = kInfo) const;
+};
+
+/**
+ * 生成から破棄までの時間を LatencyStats に加える．
+ */
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(LatencyStats& stats) : stats{stats}, start{timing::now()}
+    {
+    }
+
+    ~ScopedTimer()
+    {
+        stats.add(timing::now() - start);
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    LatencyStats& stats;
+    const uint64_t start;
+};
+
+#endif //TIMING_HPP
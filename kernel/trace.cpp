@@ -0,0 +1,66 @@
+#include "trace.hpp"
+
+#include <cstdio>
+
+void TraceBuffer::record_raw(const LogLevel level, const char* format, const uint64_t* args, const int num_args)
+{
+    // 書き込む位置をCASで予約する．割り込みハンドラが割り込んできても別の位置を予約するだけなので，
+    // 割り込みを禁止する必要はない
+    uint64_t index = write_index.load(std::memory_order_relaxed);
+    do
+    {
+        if (index - read_index.load(std::memory_order_acquire) >= CAPACITY)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    while (!write_index.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+
+    auto& rec = records[index & (CAPACITY - 1)];
+    rec.format = format;
+    rec.timestamp = __builtin_ia32_rdtsc();
+    rec.level = level;
+    for (int i = 0; i < 6; ++i)
+    {
+        rec.args[i] = i < num_args ? args[i] : 0;
+    }
+    rec.sequence.store(index + 1, std::memory_order_release);
+}
+
+size_t TraceBuffer::drain(void (*output)(LogLevel level, const char* s))
+{
+    char s[1024];
+    size_t count = 0;
+
+    const uint64_t dropped_now = dropped();
+    if (dropped_now != reported_dropped)
+    {
+        snprintf(s, sizeof(s), "[trace] %lu records dropped\n", dropped_now - reported_dropped);
+        output(kWarn, s);
+        reported_dropped = dropped_now;
+    }
+
+    uint64_t index = read_index.load(std::memory_order_relaxed);
+    while (true)
+    {
+        auto& rec = records[index & (CAPACITY - 1)];
+        // 予約されたがまだ書き終わっていない記録があれば，そこで止める
+        if (rec.sequence.load(std::memory_order_acquire) != index + 1)
+        {
+            break;
+        }
+
+        // 引数はすべて64ビットの整数として渡す．書式の変換指定はTRACE()で64ビットのものに限っている
+        // 書式が使わない分は無視される
+        const int prefix = snprintf(s, sizeof(s), "[%lu] ", rec.timestamp);
+        snprintf(s + prefix, sizeof(s) - prefix, rec.format,
+                 rec.args[0], rec.args[1], rec.args[2], rec.args[3], rec.args[4], rec.args[5]);
+        output(rec.level, s);
+
+        ++index;
+        read_index.store(index, std::memory_order_release);
+        ++count;
+    }
+    return count;
+}
@@ -0,0 +1,173 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+/**
+ * @file trace.hpp
+ *
+ * 書式化を後回しにするトレース（ログ）の記録機能を提供する．
+ *
+ * TRACE() は書式文字列へのポインタ，タイムスタンプ，引数の生の値だけを固定長のリングに記録し，
+ * 書式化は drain_trace() でリングを取り出すときに行う．記録は割り込みを禁止せずに
+ * 割り込みハンドラからも行える．TRACE_LEVEL より詳細なレベルの TRACE() は何も生成しない．
+ *
+ * 引数はすべて64ビットの整数として記録し，そのまま snprintf に渡す．そのため書式の変換指定は
+ * 64ビットの値を取る %ld，%lu，%lx などと %p だけに限り，引数の数とともにコンパイル時に確かめる．
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "logger.hpp"
+
+// コンパイル時に有効にする最も詳細なレベル
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL kDebug
+#endif
+
+struct TraceRecord
+{
+    // 書き込みが完了したら（予約した位置 + 1）になる
+    std::atomic<uint64_t> sequence;
+    const char* format;
+    uint64_t timestamp;
+    LogLevel level;
+    // 整数とポインタだけを受け付け，64ビットに広げて格納する
+    uint64_t args[6];
+};
+
+class TraceBuffer
+{
+public:
+    static constexpr size_t CAPACITY = 1024;
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+    template <typename... Args>
+    void record(const LogLevel level, const char* format, const Args... args)
+    {
+        static_assert(sizeof...(Args) <= 6, "too many trace arguments");
+        const uint64_t values[] = {to_arg(args)..., 0};
+        record_raw(level, format, values, sizeof...(Args));
+    }
+
+    void record_raw(LogLevel level, const char* format, const uint64_t* args, int num_args);
+
+    // 書式の変換指定がすべて64ビットの引数を取るもの（%l[diouxX] か %p）で，その数が num_args と等しければtrue
+    static constexpr bool valid_format(const char* format, const int num_args)
+    {
+        int conversions = 0;
+        for (const char* p = format; *p; ++p)
+        {
+            if (*p != '%')
+            {
+                continue;
+            }
+            ++p;
+            if (*p == '%')
+            {
+                continue;
+            }
+            while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+            {
+                ++p;
+            }
+            while (*p >= '0' && *p <= '9')
+            {
+                ++p;
+            }
+            if (*p == '.')
+            {
+                ++p;
+                while (*p >= '0' && *p <= '9')
+                {
+                    ++p;
+                }
+            }
+            if (*p == 'p')
+            {
+                ++conversions;
+                continue;
+            }
+            if (*p != 'l')
+            {
+                return false;
+            }
+            ++p;
+            switch (*p)
+            {
+            case 'd':
+            case 'i':
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                ++conversions;
+                break;
+            default:
+                return false;
+            }
+        }
+        return conversions == num_args;
+    }
+
+    // TRACE() の引数の数を，引数を評価せずに decltype で求めるための宣言
+    template <typename... Args>
+    static std::integral_constant<int, sizeof...(Args)> count_args(const Args&...);
+
+    /**
+     * 書き込みの完了した記録を古い順に書式化して output に渡す．
+     * 取り出しは1つのコンテキストからだけ行うこと．
+     *
+     * @return 取り出した記録の数
+     */
+    size_t drain(void (*output)(LogLevel level, const char* s));
+
+    [[nodiscard]] uint64_t dropped() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    template <typename T>
+    static uint64_t to_arg(const T value)
+    {
+        static_assert(std::is_integral_v<T> || std::is_enum_v<T> || std::is_pointer_v<T>,
+                      "trace arguments must be integers or pointers");
+        if constexpr (std::is_pointer_v<T>)
+        {
+            return reinterpret_cast<uintptr_t>(value);
+        }
+        else
+        {
+            return static_cast<uint64_t>(value);
+        }
+    }
+
+    std::atomic<uint64_t> write_index{0};
+    std::atomic<uint64_t> read_index{0};
+    std::atomic<uint64_t> dropped_{0};
+    // 取り出し側が最後に報告した取りこぼし数
+    uint64_t reported_dropped{0};
+    TraceRecord records[CAPACITY]{};
+};
+
+inline TraceBuffer trace_buffer;
+
+#define TRACE(level, format, ...) \
+    do \
+    { \
+        static_assert(TraceBuffer::valid_format(format, decltype(TraceBuffer::count_args(__VA_ARGS__))::value), \
+                      "TRACE() takes only 64-bit conversions (%ld, %lu, %lx, ...) or %p, one per argument"); \
+        if constexpr ((level) <= (TRACE_LEVEL)) \
+        { \
+            trace_buffer.record((level), format, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+inline size_t drain_trace(void (*output)(LogLevel level, const char* s))
+{
+    return trace_buffer.drain(output);
+}
+
+#endif //TRACE_HPP
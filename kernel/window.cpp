@@ -0,0 +1,52 @@
+#include "window.hpp"
+
+Window::Window(uint32_t* buffer, const int width, const int height, const FrameBufferConfig& screen_config)
+    : buffer{buffer},
+      config{screen_config},
+      writer_buf{},
+      writer_{nullptr},
+      has_transparent_color{false},
+      transparent_pixel{0}
+{
+    config.frame_buffer = reinterpret_cast<uint8_t*>(buffer);
+    config.pixels_per_scan_line = width;
+    config.horizontal_resolution = width;
+    config.vertical_resolution = height;
+    writer_ = new_pixel_writer(writer_buf, config);
+}
+
+void Window::set_transparent_color(const PixelColor& color)
+{
+    has_transparent_color = true;
+    transparent_pixel = writer_->to_pixel(color);
+}
+
+void Window::draw_to(PixelWriter& dst, const Vector2D<int> pos, const Rectangle<int>& area) const
+{
+    for (int y = area.pos.y; y < area.bottom(); ++y)
+    {
+        const uint32_t* row = buffer + width() * (y - pos.y) + (area.pos.x - pos.x);
+        if (opaque())
+        {
+            dst.write_row(area.pos.x, y, row, area.size.x);
+            continue;
+        }
+
+        // 透過色でないピクセルの連続をまとめて書く
+        int dx = 0;
+        while (dx < area.size.x)
+        {
+            if (row[dx] == transparent_pixel)
+            {
+                ++dx;
+                continue;
+            }
+            const int start = dx;
+            while (dx < area.size.x && row[dx] != transparent_pixel)
+            {
+                ++dx;
+            }
+            dst.write_row(area.pos.x + start, y, row + start, dx - start);
+        }
+    }
+}
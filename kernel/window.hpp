@@ -0,0 +1,73 @@
+#ifndef WINDOW_HPP
+#define WINDOW_HPP
+
+#include "graphics.hpp"
+
+/**
+ * RAM上に自分専用の描画領域を持つウィンドウ．
+ *
+ * 描画領域のピクセル形式は画面と同じにしてあるので，画面への転写は行単位のコピーで済む．
+ * 透過色を設定したウィンドウは，透過色以外のピクセルだけを転写する．
+ */
+class Window
+{
+public:
+    /**
+     * @param buffer  width * height ピクセル分の描画領域
+     * @param screen_config  画面の設定．ピクセル形式を合わせるために使う
+     */
+    Window(uint32_t* buffer, int width, int height, const FrameBufferConfig& screen_config);
+    Window(const Window&) = delete;
+    Window& operator =(const Window&) = delete;
+
+    [[nodiscard]] PixelWriter& writer() const
+    {
+        return *writer_;
+    }
+
+    [[nodiscard]] int width() const
+    {
+        return config.horizontal_resolution;
+    }
+
+    [[nodiscard]] int height() const
+    {
+        return config.vertical_resolution;
+    }
+
+    void set_transparent_color(const PixelColor& color);
+
+    // 透過するピクセルを持たない
+    [[nodiscard]] bool opaque() const
+    {
+        return !has_transparent_color;
+    }
+
+    /**
+     * ウィンドウの内容のうち，画面上の領域 area に重なる部分を dst に描く．
+     *
+     * @param pos  ウィンドウ左上の画面上の位置
+     * @param area  描く領域（画面座標）．ウィンドウの範囲内に切り詰められていること
+     */
+    void draw_to(PixelWriter& dst, Vector2D<int> pos, const Rectangle<int>& area) const;
+
+    void* operator new(size_t size, void* buf)
+    {
+        return buf;
+    }
+
+    void operator delete(void* obj) noexcept
+    {
+    }
+
+private:
+    uint32_t* buffer;
+    FrameBufferConfig config;
+    char writer_buf[PIXEL_WRITER_BUF_SIZE];
+    PixelWriter* writer_;
+    bool has_transparent_color;
+    uint32_t transparent_pixel;
+};
+
+
+#endif //WINDOW_HPP
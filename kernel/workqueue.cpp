@@ -0,0 +1,185 @@
+#include "workqueue.hpp"
+
+#include "cpu.hpp"
+#include "idle.hpp"
+#include "interrupt.hpp"
+#include "message.hpp"
+#include "trace.hpp"
+
+Error WorkDeque::push(WorkItem* const item)
+{
+    const int64_t b = bottom.load(std::memory_order_relaxed);
+    const int64_t t = top.load(std::memory_order_acquire);
+    if (b - t >= static_cast<int64_t>(CAPACITY))
+    {
+        return MAKE_ERROR(Error::kFull);
+    }
+    items[b & MASK].store(item, std::memory_order_relaxed);
+    // 要素を書いてから底を進める．steal() は底を読んでから要素を読む
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+WorkItem* WorkDeque::pop()
+{
+    // 先に底を下げて取り出す要素を予約し，それから頂上を読む．
+    // 順序が入れ替わると，steal() と同じ要素を両方が取ってしまう
+    const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+
+    if (t > b)
+    {
+        // 空だった
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    WorkItem* item = items[b & MASK].load(std::memory_order_relaxed);
+    if (t == b)
+    {
+        // 最後の1つは steal() と取り合うので，頂上を進められた方が取る
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            item = nullptr;
+        }
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+}
+
+WorkItem* WorkDeque::steal()
+{
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b)
+    {
+        return nullptr;
+    }
+
+    WorkItem* item = items[t & MASK].load(std::memory_order_relaxed);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    {
+        return nullptr;
+    }
+    return item;
+}
+
+bool WorkDeque::empty() const
+{
+    return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+}
+
+void WorkItem::wait()
+{
+    while (!done())
+    {
+        if (!workqueue::run_one())
+        {
+            __builtin_ia32_pause();
+        }
+    }
+}
+
+namespace
+{
+    // 1回の通知で続けて実行する仕事の数．残っていれば他のメッセージを処理してから続ける
+    constexpr int RUN_BATCH = 64;
+
+    std::atomic<unsigned int> next_wake{0};
+
+    // 他のコアを1つ順番に選んで起こす．眠っていなければ通知が残るだけで，そのコアは次の dispatch() で盗みに来る
+    void wake_other_cpu()
+    {
+        const int n = cpu::count();
+        if (n <= 1)
+        {
+            return;
+        }
+        const int offset = 1 + static_cast<int>(next_wake.fetch_add(1, std::memory_order_relaxed) % (n - 1));
+        auto& target = cpu::at((this_cpu().index + offset) % n);
+        target.dispatcher.notify(Message::Type::WorkAvailable);
+        // MWAIT で眠っていれば通知の書き込みだけで起きるが，hlt で眠っていれば割り込みが要る
+        if (!idle::uses_mwait())
+        {
+            cpu::send_interrupt(target, InterruptVector::Wakeup);
+        }
+    }
+
+    WorkItem* steal_from_others(const CPU& self)
+    {
+        const int n = cpu::count();
+        for (int i = 1; i < n; ++i)
+        {
+            const int victim = (self.index + i) % n;
+            if (auto item = cpu::at(victim).work_deque.steal())
+            {
+                TRACE(kDebug, "workqueue: cpu %ld stole from cpu %ld\n", self.index, victim);
+                return item;
+            }
+        }
+        return nullptr;
+    }
+
+    void on_work_available(const Message& msg)
+    {
+        for (int i = 0; i < RUN_BATCH; ++i)
+        {
+            if (!workqueue::run_one())
+            {
+                return;
+            }
+        }
+        this_cpu().dispatcher.notify(Message::Type::WorkAvailable);
+    }
+}
+
+namespace workqueue
+{
+    void initialize_this_cpu()
+    {
+        this_cpu().dispatcher.set_handler(Message::Type::WorkAvailable, EventDispatcher::kLow, on_work_available);
+    }
+
+    Error submit(WorkItem& item)
+    {
+        auto& self = this_cpu();
+        item.done_.store(false, std::memory_order_relaxed);
+
+        // デックの持ち主側の操作は，同じコアの別の文脈と重ならないようにする
+        const auto rflags = save_and_disable_interrupts();
+        const auto err = self.work_deque.push(&item);
+        restore_interrupts(rflags);
+        if (err)
+        {
+            item.run();
+            return MAKE_ERROR(Error::kSuccess);
+        }
+
+        self.dispatcher.notify(Message::Type::WorkAvailable);
+        wake_other_cpu();
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    bool run_one()
+    {
+        auto& self = this_cpu();
+        const auto rflags = save_and_disable_interrupts();
+        WorkItem* item = self.work_deque.pop();
+        restore_interrupts(rflags);
+
+        if (item == nullptr)
+        {
+            item = steal_from_others(self);
+        }
+        if (item == nullptr)
+        {
+            return false;
+        }
+        item->run();
+        return true;
+    }
+}
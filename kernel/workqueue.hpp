@@ -0,0 +1,106 @@
+#ifndef WORKQUEUE_HPP
+#define WORKQUEUE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+
+/**
+ * @file workqueue.hpp
+ *
+ * どのコアで動いてもよい短い仕事（WorkItem）を，全コアに分散して実行する．
+ *
+ * 各コアは自分の WorkDeque を持ち，自分が積んだ仕事は後に積んだものから取り出す．
+ * 仕事のないコアは他のコアのデックの反対側から古いものを盗む．
+ * 仕事を積むと眠っているコアを1つ起こすので，多数の仕事を積めば順に全コアが手伝い始める．
+ *
+ * 仕事の中ではヒープとログを使わない（どちらもコア間で排他していない）．
+ */
+
+class WorkItem;
+
+namespace workqueue
+{
+    // 呼んだコアのデックに積む．一杯ならその場で実行する
+    Error submit(WorkItem& item);
+
+    // 次の仕事を1つ実行する．自分のデック，他のコアの順に探す
+    // 何も実行しなければ false を返す
+    bool run_one();
+
+    // 呼んだコアの EventDispatcher で仕事を処理できるようにする．各コアで1回呼ぶ
+    void initialize_this_cpu();
+}
+
+/**
+ * 1つの仕事．完了を待つためのハンドルも兼ねる．
+ * メモリは投入する側が持ち，完了するまで破棄してはならない．完了した後は再び投入できる．
+ */
+class WorkItem
+{
+public:
+    using Function = void (*)(void* arg);
+
+    WorkItem(const Function function, void* const arg) : function{function}, arg{arg}
+    {
+    }
+
+    WorkItem(const WorkItem&) = delete;
+    WorkItem& operator=(const WorkItem&) = delete;
+
+    [[nodiscard]] bool done() const
+    {
+        return done_.load(std::memory_order_acquire);
+    }
+
+    // 完了するまで待つ．待つ間はこのコアで他の仕事を実行する．割り込みハンドラからは呼べない
+    void wait();
+
+private:
+    friend Error workqueue::submit(WorkItem& item);
+    friend bool workqueue::run_one();
+
+    void run()
+    {
+        function(arg);
+        done_.store(true, std::memory_order_release);
+    }
+
+    const Function function;
+    void* const arg;
+    std::atomic<bool> done_{true};
+};
+
+/**
+ * Chase-Lev の work-stealing デック（容量固定）．
+ *
+ * push() と pop() は持ち主のコアだけが底の側で行い，steal() は他のコアが頂上の側で行う．
+ * 持ち主は最後の1つを取り合うときだけ CAS を使い，それ以外は頂上の側と衝突しない．
+ * 持ち主の push() と pop() は互いに割り込まれてはならないので，割り込みハンドラからは積まない．
+ */
+class WorkDeque
+{
+public:
+    static constexpr size_t CAPACITY = 256;
+
+    // 持ち主から呼ぶ．一杯なら kFull を返す
+    Error push(WorkItem* item);
+    // 持ち主から呼ぶ．空なら nullptr
+    WorkItem* pop();
+    // 他のコアから呼ぶ．空か，他のコアと取り合って負ければ nullptr
+    WorkItem* steal();
+
+    [[nodiscard]] bool empty() const;
+
+private:
+    static constexpr size_t MASK = CAPACITY - 1;
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::array<std::atomic<WorkItem*>, CAPACITY> items{};
+};
+
+#endif //WORKQUEUE_HPP
@@ -0,0 +1,113 @@
+#include "xhci_interrupter.hpp"
+
+#include <cstring>
+
+namespace
+{
+    // ケーパビリティレジスタのオフセット
+    constexpr size_t HCSPARAMS1 = 0x04;
+    constexpr size_t RTSOFF = 0x18;
+
+    // ランタイムレジスタの中のインタラプタレジスタセットの位置と大きさ
+    constexpr size_t INTERRUPTER_SET_OFFSET = 0x20;
+    constexpr size_t INTERRUPTER_SET_SIZE = 0x20;
+
+    // インタラプタレジスタセットの中のオフセット（32ビット単位）
+    constexpr size_t IMAN = 0;
+    constexpr size_t ERSTSZ = 2;
+    constexpr size_t ERSTBA = 4;
+    constexpr size_t ERDP = 6;
+
+    constexpr uint32_t IMAN_IP = 1u << 0; // 1を書くと保留中の割り込みを解除する
+    constexpr uint32_t IMAN_IE = 1u << 1;
+    constexpr uint64_t ERDP_EHB = 1u << 3; // 1を書くとイベント処理中の状態を解除する
+
+    constexpr size_t RING_ALIGNMENT = 64;
+    constexpr size_t RING_BOUNDARY = 64 * 1024;
+
+    uint32_t read_capability(const uintptr_t mmio_base, const size_t offset)
+    {
+        return *reinterpret_cast<volatile uint32_t*>(mmio_base + offset);
+    }
+}
+
+unsigned int XhcInterrupter::max_interrupters(const uintptr_t mmio_base)
+{
+    return read_capability(mmio_base, HCSPARAMS1) >> 8 & 0x7ffu;
+}
+
+Error XhcInterrupter::initialize(const uintptr_t mmio_base, const unsigned int index, BuddyAllocator& allocator)
+{
+    if (index == 0 || index >= max_interrupters(mmio_base))
+    {
+        return MAKE_ERROR(Error::kInvalidArgument);
+    }
+
+    const auto [ring_mem, ring_err] = allocator.allocate(RING_SIZE * sizeof(XhcEventTRB), RING_ALIGNMENT,
+                                                         RING_BOUNDARY);
+    if (ring_err)
+    {
+        return ring_err;
+    }
+    const auto [table_mem, table_err] = allocator.allocate(sizeof(SegmentTableEntry), RING_ALIGNMENT);
+    if (table_err)
+    {
+        allocator.free(ring_mem);
+        return table_err;
+    }
+
+    // サイクルビットが0の TRB は，最初の一周ではまだ書かれていないことを表す
+    memset(ring_mem, 0, RING_SIZE * sizeof(XhcEventTRB));
+    const auto table = static_cast<SegmentTableEntry*>(table_mem);
+    table->ring_segment_base = reinterpret_cast<uintptr_t>(ring_mem);
+    table->ring_segment_size = RING_SIZE;
+    table->reserved = 0;
+
+    ring = static_cast<volatile XhcEventTRB*>(ring_mem);
+    dequeue = 0;
+    cycle = true;
+    index_ = index;
+
+    const uint32_t runtime_offset = read_capability(mmio_base, RTSOFF) & ~0x1fu;
+    registers = reinterpret_cast<volatile uint32_t*>(
+        mmio_base + runtime_offset + INTERRUPTER_SET_OFFSET + INTERRUPTER_SET_SIZE * index);
+
+    // ERSTBA を書いた時点で xHC がテーブルを読むので，大きさと取り出し位置を先に設定する
+    registers[ERSTSZ] = (registers[ERSTSZ] & 0xffff0000u) | 1u;
+    write_register64(ERDP, reinterpret_cast<uintptr_t>(ring_mem));
+    write_register64(ERSTBA, reinterpret_cast<uintptr_t>(table_mem));
+    registers[IMAN] = IMAN_IP | IMAN_IE;
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+XhcEventTRB XhcInterrupter::front() const
+{
+    XhcEventTRB trb{};
+    for (int i = 0; i < 4; ++i)
+    {
+        trb.data[i] = ring[dequeue].data[i];
+    }
+    return trb;
+}
+
+void XhcInterrupter::pop()
+{
+    if (++dequeue == RING_SIZE)
+    {
+        dequeue = 0;
+        cycle = !cycle;
+    }
+}
+
+void XhcInterrupter::acknowledge()
+{
+    write_register64(ERDP, reinterpret_cast<uintptr_t>(&ring[dequeue]) | ERDP_EHB);
+    registers[IMAN] = IMAN_IP | IMAN_IE;
+}
+
+void XhcInterrupter::write_register64(const size_t offset, const uint64_t value)
+{
+    // 64ビットのレジスタは下位，上位の順に32ビットずつ書く
+    registers[offset] = static_cast<uint32_t>(value);
+    registers[offset + 1] = static_cast<uint32_t>(value >> 32);
+}
@@ -0,0 +1,93 @@
+#ifndef XHCI_INTERRUPTER_HPP
+#define XHCI_INTERRUPTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "buddy.hpp"
+#include "error.hpp"
+
+/**
+ * @file xhci_interrupter.hpp
+ *
+ * xHC のセカンダリインタラプタ（1番以降）にイベントリングを持たせる．
+ *
+ * プライマリのインタラプタ0とそのイベントリングは xHCI ドライバが持つ．ここではランタイムレジスタの
+ * インタラプタレジスタセット（IMAN，ERSTSZ，ERSTBA，ERDP）を直接設定する．
+ * MSI-X のエントリ i はインタラプタ i の割り込みになるので，リング毎に別のベクタと宛先を設定できる．
+ * どの転送のイベントがどのインタラプタに届くかは転送TRBの Interrupter Target で決まり，それはドライバが設定する．
+ */
+
+// イベントリングの TRB
+struct XhcEventTRB
+{
+    uint32_t data[4];
+
+    [[nodiscard]] bool cycle() const
+    {
+        return data[3] & 1u;
+    }
+
+    [[nodiscard]] unsigned int type() const
+    {
+        return data[3] >> 10 & 0x3fu;
+    }
+};
+
+class XhcInterrupter
+{
+public:
+    // リングの TRB の数．リングは 64KiB 境界をまたいではならないので，4KiB に収める
+    static constexpr size_t RING_SIZE = 256;
+
+    // xHC が持つインタラプタの数（HCSPARAMS1 の MaxIntrs）
+    static unsigned int max_interrupters(uintptr_t mmio_base);
+
+    // mmio_base の xHC のインタラプタ index（1以上）に allocator から確保したイベントリングを設定し，割り込みを許可する
+    Error initialize(uintptr_t mmio_base, unsigned int index, BuddyAllocator& allocator);
+
+    [[nodiscard]] bool has_front() const
+    {
+        return (ring[dequeue].data[3] & 1u) == static_cast<uint32_t>(cycle);
+    }
+
+    [[nodiscard]] XhcEventTRB front() const;
+    void pop();
+    // 取り出した位置を xHC に知らせ，保留中の割り込みを解除する．まとめて pop() した後に1回呼ぶ
+    void acknowledge();
+
+    [[nodiscard]] unsigned int index() const
+    {
+        return index_;
+    }
+
+    void* operator new(size_t size, void* buf)
+    {
+        return buf;
+    }
+
+    void operator delete(void* obj) noexcept
+    {
+    }
+
+private:
+    // ERST（イベントリングセグメントテーブル）の1エントリ
+    struct SegmentTableEntry
+    {
+        uint64_t ring_segment_base;
+        uint32_t ring_segment_size;
+        uint32_t reserved;
+    };
+
+    void write_register64(size_t offset, uint64_t value);
+
+    // インタラプタレジスタセットの先頭
+    volatile uint32_t* registers = nullptr;
+    volatile XhcEventTRB* ring = nullptr;
+    size_t dequeue = 0;
+    // xHC がまだ書いていない TRB のサイクルビットはこの値と異なる
+    bool cycle = true;
+    unsigned int index_ = 0;
+};
+
+#endif //XHCI_INTERRUPTER_HPP
@@ -0,0 +1,186 @@
+/**
+ * @file buddy_test.cpp
+ *
+ * BuddyAllocator をホストで試す．
+ * 整列と境界の制約を付けた確保と解放をランダムに繰り返し，制約と内容が壊れていないことを確かめる．
+ * 一定回数毎に確保・解放にかかった時間と，空いている最大のブロック（断片化の度合い）を出す．
+ */
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "buddy.hpp"
+
+BuddyAllocator* dma_allocator;
+
+namespace
+{
+    // カーネルと同じく物理アドレスと仮想アドレスが一致するように，固定のアドレスに領域を置く
+    constexpr uintptr_t ARENA_BASE = 0x10000000;
+    constexpr size_t ARENA_SIZE = 64 * 1024 * 1024;
+    constexpr size_t MAX_BLOCKS = 12;
+
+    constexpr int NUM_OPERATIONS = 200'000;
+    constexpr int REPORT_INTERVAL = 20'000;
+    constexpr size_t MAX_BYTES = 70'000;
+    constexpr size_t BOUNDARY = 64 * 1024;
+    // 空きがこの割合を下回るまでは確保を多めに，下回ったら解放を多めにして，使用率の高い状態を保つ
+    constexpr size_t TARGET_FREE_PERCENT = 30;
+
+    using Clock = std::chrono::steady_clock;
+
+    uint64_t nanoseconds_since(const Clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+
+    struct Allocation
+    {
+        uint8_t* pointer;
+        size_t bytes;
+    };
+
+    struct LatencyStats
+    {
+        uint64_t count = 0;
+        uint64_t total_ns = 0;
+        uint64_t max_ns = 0;
+
+        void add(const uint64_t ns)
+        {
+            ++count;
+            total_ns += ns;
+            max_ns = std::max(max_ns, ns);
+        }
+
+        [[nodiscard]] uint64_t average() const
+        {
+            return count ? total_ns / count : 0;
+        }
+    };
+
+    // 確保した領域にはアドレスから決まる値を書いておき，解放するときに壊れていないか確かめる
+    uint8_t fill_value(const uint8_t* p)
+    {
+        return static_cast<uint8_t>(reinterpret_cast<uintptr_t>(p) >> 12);
+    }
+
+    bool intact(const Allocation& a)
+    {
+        const uint8_t value = fill_value(a.pointer);
+        for (size_t i = 0; i < a.bytes; ++i)
+        {
+            if (a.pointer[i] != value)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main()
+{
+    void* arena = mmap(reinterpret_cast<void*>(ARENA_BASE), ARENA_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (arena != reinterpret_cast<void*>(ARENA_BASE))
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    MemoryDescriptor descriptor{
+        static_cast<uint32_t>(MemoryType::EfiConventionalMemory), ARENA_BASE, 0, ARENA_SIZE / BYTES_PER_FRAME, 0
+    };
+    const MemoryMap memory_map{sizeof(descriptor), &descriptor, sizeof(descriptor), 0, sizeof(descriptor), 1};
+    static FrameManager frames;
+    if (auto err = frames.initialize(memory_map))
+    {
+        printf("FrameManager::initialize: %s\n", err.Name());
+        return 1;
+    }
+    static BuddyAllocator buddy;
+    if (auto err = buddy.initialize(frames, MAX_BLOCKS))
+    {
+        printf("BuddyAllocator::initialize: %s\n", err.Name());
+        return 1;
+    }
+    const size_t total_frames = buddy.free_frames();
+    printf("arena: %zu frames, largest order %d\n", total_frames, buddy.largest_free_order());
+
+    std::mt19937 rng{1};
+    std::vector<Allocation> live;
+    LatencyStats alloc_stats, free_stats;
+    int violations = 0;
+    int failures = 0;
+
+    printf("%8s %6s %11s %7s %9s %9s %9s %9s\n",
+           "ops", "live", "free", "largest", "alloc_ns", "alloc_max", "free_ns", "free_max");
+    for (int op = 1; op <= NUM_OPERATIONS; ++op)
+    {
+        const bool mostly_free = buddy.free_frames() * 100 < total_frames * TARGET_FREE_PERCENT;
+        if (!live.empty() && rng() % 10 < (mostly_free ? 6u : 4u))
+        {
+            const size_t index = rng() % live.size();
+            const Allocation a = live[index];
+            violations += !intact(a);
+            const auto start = Clock::now();
+            buddy.free(a.pointer);
+            free_stats.add(nanoseconds_since(start));
+            live[index] = live.back();
+            live.pop_back();
+        }
+        else
+        {
+            const size_t boundary = rng() % 2 ? BOUNDARY : 0;
+            // 境界をまたがない領域は境界の大きさまでしか取れない
+            const size_t bytes = 1 + rng() % (boundary ? boundary : MAX_BYTES);
+            const size_t alignment = BYTES_PER_FRAME << (rng() % 5);
+            const auto start = Clock::now();
+            const auto [block, err] = buddy.allocate(bytes, alignment, boundary);
+            alloc_stats.add(nanoseconds_since(start));
+            if (err)
+            {
+                ++failures;
+            }
+            else
+            {
+                auto p = static_cast<uint8_t*>(block);
+                const auto addr = reinterpret_cast<uintptr_t>(p);
+                violations += addr % alignment != 0;
+                violations += boundary && addr / boundary != (addr + bytes - 1) / boundary;
+                memset(p, fill_value(p), bytes);
+                live.push_back({p, bytes});
+            }
+        }
+
+        if (op % REPORT_INTERVAL == 0)
+        {
+            printf("%8d %6zu %5zu/%5zu %7d %9lu %9lu %9lu %9lu\n",
+                   op, live.size(), buddy.free_frames(), total_frames, buddy.largest_free_order(),
+                   alloc_stats.average(), alloc_stats.max_ns, free_stats.average(), free_stats.max_ns);
+            alloc_stats = {};
+            free_stats = {};
+        }
+    }
+
+    for (const auto& a : live)
+    {
+        violations += !intact(a);
+        buddy.free(a.pointer);
+    }
+
+    // すべて解放すれば，バディの併合で最初と同じ状態に戻るはず
+    const bool restored = buddy.free_frames() == total_frames &&
+        buddy.largest_free_order() == BuddyAllocator::MAX_ORDER;
+    printf("violations %d, failed allocations %d, %s\n",
+           violations, failures, restored ? "fully coalesced" : "NOT coalesced");
+    return violations == 0 && restored ? 0 : 1;
+}
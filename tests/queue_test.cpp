@@ -0,0 +1,152 @@
+/**
+ * @file queue_test.cpp
+ *
+ * SPSCQueue をホストのスレッドで試す．
+ * 書き込み側と読み出し側を別スレッドで走らせて順序と欠落を確かめ，
+ * 1スレッドでの push/pop の速さを ArrayQueue と比べる．
+ */
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+#include "queue.hpp"
+
+namespace
+{
+    constexpr uint64_t STRESS_ITEMS = 2'000'000;
+    constexpr uint64_t BENCHMARK_ITEMS = 20'000'000;
+    constexpr size_t CAPACITY = 256;
+    // 1回に積んでから取り出す数．ArrayQueue と SPSCQueue で同じにする
+    constexpr size_t BURST = 64;
+
+    using Clock = std::chrono::steady_clock;
+
+    double seconds_since(const Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // 読み出し側は front()/pop() と pop_batch() を交互に使い，値が 0, 1, 2, ... の順に届くことを確かめる
+    bool stress_test()
+    {
+        static SPSCQueue<uint64_t, CAPACITY> queue;
+
+        std::thread producer{[]
+        {
+            for (uint64_t i = 0; i < STRESS_ITEMS; ++i)
+            {
+                // 1コアのホストでも相手が進めるように，一杯なら譲る
+                while (queue.push(i))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }};
+
+        uint64_t expected = 0;
+        uint64_t errors = 0;
+        uint64_t batch[BURST];
+        bool use_batch = false;
+        while (expected < STRESS_ITEMS)
+        {
+            if (use_batch)
+            {
+                const size_t n = queue.pop_batch(batch, BURST);
+                for (size_t i = 0; i < n; ++i)
+                {
+                    errors += batch[i] != expected++;
+                }
+            }
+            else if (queue.count() != 0)
+            {
+                errors += queue.front() != expected++;
+                queue.pop();
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+            use_batch = !use_batch;
+        }
+        producer.join();
+
+        const bool empty = queue.count() == 0 && queue.pop();
+        printf("stress: %lu items, %lu out of order, queue %s\n",
+               STRESS_ITEMS, errors, empty ? "empty" : "NOT empty");
+        return errors == 0 && empty;
+    }
+
+    template <typename Queue>
+    double burst_throughput(Queue& queue)
+    {
+        uint64_t sum = 0;
+        const auto start = Clock::now();
+        for (uint64_t i = 0; i < BENCHMARK_ITEMS; i += BURST)
+        {
+            for (size_t j = 0; j < BURST; ++j)
+            {
+                queue.push(i + j);
+            }
+            for (size_t j = 0; j < BURST; ++j)
+            {
+                sum += queue.front();
+                queue.pop();
+            }
+        }
+        const double elapsed = seconds_since(start);
+        // 計算を消されないようにする
+        __asm__ volatile("" :: "r"(sum));
+        return BENCHMARK_ITEMS / elapsed / 1e6;
+    }
+
+    double cross_thread_throughput()
+    {
+        static SPSCQueue<uint64_t, CAPACITY> queue;
+
+        const auto start = Clock::now();
+        std::thread producer{[]
+        {
+            for (uint64_t i = 0; i < BENCHMARK_ITEMS; ++i)
+            {
+                // 1コアのホストでも相手が進めるように，一杯なら譲る
+                while (queue.push(i))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }};
+
+        uint64_t received = 0;
+        uint64_t batch[BURST];
+        while (received < BENCHMARK_ITEMS)
+        {
+            const size_t n = queue.pop_batch(batch, BURST);
+            if (n == 0)
+            {
+                std::this_thread::yield();
+            }
+            received += n;
+        }
+        producer.join();
+        return BENCHMARK_ITEMS / seconds_since(start) / 1e6;
+    }
+}
+
+int main()
+{
+    if (!stress_test())
+    {
+        return 1;
+    }
+
+    std::array<uint64_t, CAPACITY> array_buf{};
+    ArrayQueue<uint64_t> array_queue{array_buf};
+    static SPSCQueue<uint64_t, CAPACITY> spsc_queue;
+    printf("1 thread:  ArrayQueue %.1f Mitems/s, SPSCQueue %.1f Mitems/s\n",
+           burst_throughput(array_queue), burst_throughput(spsc_queue));
+    printf("2 threads: SPSCQueue %.1f Mitems/s\n", cross_thread_throughput());
+    return 0;
+}